@@ -0,0 +1,449 @@
+// microbenchmarks for the simulation hot paths, results as CSV or JSON
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "flock.hpp"
+#include "boids.hpp"
+#include "checkpoint.hpp"
+#include "culling.hpp"
+#include "rng.hpp"
+#include "trajectory.hpp"
+#include <common/objloader.hpp>
+#include <common/vboindexer.hpp>
+
+struct BenchResult {
+	std::string name;
+	int n;				// problem size
+	int threads;
+	int reps;
+	double meanMs;
+	double minMs;
+	double nsPerItem;	// min time divided by n
+};
+
+std::vector<BenchResult> Results;
+// keeps the optimizer from dropping work whose result is never used
+volatile float Sink;
+
+const char* SimdName = "";
+double minSeconds = 0.25;
+int minReps = 3;
+int maxReps = 1000;
+
+// runs body until both minReps and minSeconds are reached
+template <typename Body>
+void measure(const char* name, int n, int threads, Body body) {
+	double total = 0;
+	double best = 1e30;
+	int reps = 0;
+	while (reps < maxReps && (reps < minReps || total < minSeconds)) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		body();
+		double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		total += ms / 1000.0;
+		best = std::min(best, ms);
+		reps++;
+	}
+
+	BenchResult result;
+	result.name = name;
+	result.n = n;
+	result.threads = threads;
+	result.reps = reps;
+	result.meanMs = 1000.0 * total / reps;
+	result.minMs = best;
+	result.nsPerItem = 1e6 * best / n;
+	Results.push_back(result);
+	fprintf(stderr, "%-34s n=%-8d threads=%-3d %10.3f ms  %9.2f ns/item\n", name, n, threads, best, result.nsPerItem);
+}
+
+void benchCreateBoids(int n) {
+	measure("createBoids", n, 1, [n] { createBoids(n); });
+}
+
+void benchThreeLaws(int n) {
+	createBoids(n);
+	prepareNeighborSearch();
+	const FlockState& flock = getFlockState();
+	measure("threeLaws", n, 1, [n, &flock] {
+		glm::vec3 total = glm::vec3();
+		glm::vec3 color;
+		for (int i = 0; i < n; i++) {
+			total += threeLaws(flock, i, color);
+		}
+		Sink = total.x;
+	});
+}
+
+// the same scan over Verlet lists, built before timing starts
+void benchThreeLawsLists(int n) {
+	createBoids(n);
+	setNeighborSearch(NEIGHBOR_LIST);
+	prepareNeighborSearch();
+	const FlockState& flock = getFlockState();
+	measure("threeLaws/lists", n, 1, [n, &flock] {
+		glm::vec3 total = glm::vec3();
+		glm::vec3 color;
+		for (int i = 0; i < n; i++) {
+			total += threeLaws(flock, i, color);
+		}
+		Sink = total.x;
+	});
+	setNeighborSearch(SPATIAL_GRID);
+}
+
+void benchRotateBetweenVectors(int n) {
+	std::vector<glm::vec3> headings(n);
+	for (int i = 0; i < n; i++) {
+		Philox4x32 bits = boidRandom(1, RNG_NOISE, 0, i);
+		headings[i] = glm::normalize(glm::vec3(randomSigned(bits.v[0]), randomSigned(bits.v[1]), randomSigned(bits.v[2])) + glm::vec3(0, 0, 1e-3f));
+	}
+	measure("rotateBetweenVectors", n, 1, [n, &headings] {
+		float total = 0;
+		for (int i = 0; i < n; i++) {
+			total += rotateBetweenVectors(glm::vec3(0, 1.0f, 0), headings[i])[0][0];
+		}
+		Sink = total;
+	});
+}
+
+void benchStep(int n, int threads) {
+	setThreadCount(threads);
+	createBoids(n);
+	// let the flock leave its initial lattice first
+	computeBoidModelMatrices();
+	measure("computeBoidModelMatrices", n, threads, [] { computeBoidModelMatrices(); });
+}
+
+// same step writing 24 byte BoidInstances instead of model matrices
+void benchStepCompact(int n, int threads) {
+	setThreadCount(threads);
+	createBoids(n);
+	std::vector<BoidInstance> instances(n);
+	setCompactInstanceOutput(instances.data(), NULL);
+	computeBoidModelMatrices();
+	measure("computeBoidModelMatrices/compact", n, threads, [] { computeBoidModelMatrices(); });
+	setInstanceOutput(NULL, NULL);
+}
+
+// same step with boids that have no neighbors steering less often. The
+// spawn cube is sparse up to about 10000 boids, denser flocks keep
+// nearly every boid at full rate
+void benchStepAdaptive(int n, int threads) {
+	setThreadCount(threads);
+	createBoids(n);
+	setUpdateSchedule(UPDATE_BY_ACTIVITY);
+	// every rate level up to the slowest gets reached
+	for (int step = 0; step < 8; step++) computeBoidModelMatrices();
+	measure("computeBoidModelMatrices/adaptive", n, threads, [] { computeBoidModelMatrices(); });
+	setUpdateSchedule(UPDATE_ALL);
+}
+
+// same step over Verlet lists, rebuilt whenever a boid moved skin / 2
+void benchStepLists(int n, int threads) {
+	setThreadCount(threads);
+	createBoids(n);
+	setNeighborSearch(NEIGHBOR_LIST);
+	computeBoidModelMatrices();
+	measure("computeBoidModelMatrices/lists", n, threads, [] { computeBoidModelMatrices(); });
+	setNeighborSearch(SPATIAL_GRID);
+}
+
+// frustum culling and LOD sorting of one frame, from the window's
+// default camera with the flock filling the view
+void benchCull(int n, int threads) {
+	createBoids(n);
+	std::vector<BoidInstance> instances(n), visible(n);
+	std::vector<glm::vec3> colors(n), visibleColors(n);
+	setCompactInstanceOutput(instances.data(), colors.data());
+	computeBoidModelMatrices();
+	setInstanceOutput(NULL, NULL);
+
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 500.0f);
+	glm::mat4 view = glm::lookAt(glm::vec3(0, 0, 200), glm::vec3(0), glm::vec3(0, 1, 0));
+	FlockCuller culler(threads);
+	measure("cullFlock", n, threads, [&] {
+		Sink = (float)culler.cull(instances.data(), colors.data(), n, view, projection, 768, visible.data(), visibleColors.data());
+	});
+}
+
+// arrow.obj repeated copies times, each copy shifted so no vertices merge.
+// Index is unsigned short or unsigned int
+template <typename Index>
+void benchIndexVBO(const char* name, const std::vector<glm::vec3>& vertices, const std::vector<glm::vec2>& uvs, const std::vector<glm::vec3>& normals, int copies) {
+	std::vector<glm::vec3> inVertices, inNormals;
+	std::vector<glm::vec2> inUvs;
+	for (int c = 0; c < copies; c++) {
+		for (size_t i = 0; i < vertices.size(); i++) {
+			inVertices.push_back(vertices[i] + glm::vec3(3.0f * c, 0, 0));
+			inUvs.push_back(uvs[i]);
+			inNormals.push_back(normals[i]);
+		}
+	}
+
+	measure(name, (int)inVertices.size(), 1, [&] {
+		std::vector<Index> indices;
+		std::vector<glm::vec3> outVertices, outNormals;
+		std::vector<glm::vec2> outUvs;
+		indexVBO(inVertices, inUvs, inNormals, indices, outVertices, outUvs, outNormals);
+		Sink = (float)indices.size();
+	});
+}
+
+// a square grid of about n triangles written as an OBJ of quads, parsed
+// by loadOBJParallel. n is the triangle count
+void benchLoadOBJ(int n, const std::vector<int>& threadCounts) {
+	const char* path = "boids_bench_grid.obj";
+	int side = std::max(2, (int)std::sqrt(n / 2.0) + 1);
+	FILE* file = fopen(path, "w");
+	if (file == NULL) {
+		fprintf(stderr, "Skipping loadOBJ, can't write %s\n", path);
+		return;
+	}
+	for (int y = 0; y < side; y++) {
+		for (int x = 0; x < side; x++) {
+			fprintf(file, "v %f %f %f\nvt %f %f\nvn 0 0 1\n", x * 0.1f, y * 0.1f, 0.01f * ((x * 7 + y * 3) % 11), x / (float)side, y / (float)side);
+		}
+	}
+	for (int y = 1; y < side; y++) {
+		for (int x = 1; x < side; x++) {
+			int c = y * side + x + 1;
+			fprintf(file, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n", c - side - 1, c - side - 1, c - side - 1,
+				c - side, c - side, c - side, c, c, c, c - 1, c - 1, c - 1);
+		}
+	}
+	fclose(file);
+
+	int triangles = 2 * (side - 1) * (side - 1);
+	for (size_t t = 0; t < threadCounts.size(); t++) {
+		int threads = threadCounts[t];
+		measure("loadOBJ", triangles, threads, [&] {
+			std::vector<glm::vec3> vertices, normals;
+			std::vector<glm::vec2> uvs;
+			loadOBJParallel(path, vertices, uvs, normals, threads);
+			Sink = (float)vertices.size();
+		});
+	}
+	remove(path);
+}
+
+// records a flock alternating between two consecutive steps, so every
+// record carries a real step's change, then plays the file back. Seeks
+// alternate between the two records furthest from their keyframes
+void benchTrajectory(int n, int threads) {
+	const char* path = "boids_bench_trajectory.btrj";
+	const int interval = 32;
+	createBoids(n);
+	FlockState states[2];
+	computeBoidModelMatrices();
+	states[0] = getFlockState();
+	computeBoidModelMatrices();
+	states[1] = getFlockState();
+
+	TrajectoryRecorder recorder;
+	if (!recorder.open(path, interval, threads)) {
+		fprintf(stderr, "Skipping trajectory, can't write %s\n", path);
+		return;
+	}
+	uint64_t step = 0;
+	measure("trajectory/record", n, threads, [&] {
+		recorder.record(states[step & 1], step);
+		step++;
+	});
+	while (step < 2 * interval) {
+		recorder.record(states[step & 1], step);
+		step++;
+	}
+	recorder.close();
+
+	TrajectoryReader reader;
+	if (reader.open(path, threads)) {
+		FlockState state;
+		measure("trajectory/next", n, threads, [&] {
+			if (!reader.next(state)) reader.seek(0, state);
+			Sink = state.px[0];
+		});
+		uint64_t target = interval - 1;
+		measure("trajectory/seek", n, threads, [&] {
+			reader.seek(target, state);
+			target = target == interval - 1 ? 2 * interval - 1 : interval - 1;
+			Sink = state.px[0];
+		});
+	}
+	reader.close();
+	remove(path);
+}
+
+// a fresh flock written out and read back, mostly page cache speed
+void benchCheckpoint(int n) {
+	const char* path = "boids_bench.checkpoint";
+	createBoids(n);
+	if (!saveCheckpoint(path)) {
+		fprintf(stderr, "Skipping checkpoint, can't write %s\n", path);
+		return;
+	}
+	measure("checkpoint/save", n, 1, [path] { saveCheckpoint(path); });
+	measure("checkpoint/load", n, 1, [path] {
+		loadCheckpoint(path);
+		Sink = getFlockState().px[0];
+	});
+	remove(path);
+}
+
+void writeCsv(FILE* out) {
+	fprintf(out, "benchmark,n,threads,simd,reps,mean_ms,min_ms,ns_per_item\n");
+	for (size_t i = 0; i < Results.size(); i++) {
+		const BenchResult& r = Results[i];
+		fprintf(out, "%s,%d,%d,%s,%d,%.6f,%.6f,%.3f\n", r.name.c_str(), r.n, r.threads,
+			SimdName, r.reps, r.meanMs, r.minMs, r.nsPerItem);
+	}
+}
+
+void writeJson(FILE* out) {
+	fprintf(out, "{\n  \"simd\": \"%s\",\n  \"hardware_threads\": %u,\n  \"results\": [\n",
+		SimdName, std::thread::hardware_concurrency());
+	for (size_t i = 0; i < Results.size(); i++) {
+		const BenchResult& r = Results[i];
+		fprintf(out, "    {\"benchmark\": \"%s\", \"n\": %d, \"threads\": %d, \"reps\": %d, \"mean_ms\": %.6f, \"min_ms\": %.6f, \"ns_per_item\": %.3f}%s\n",
+			r.name.c_str(), r.n, r.threads, r.reps, r.meanMs, r.minMs, r.nsPerItem, i + 1 < Results.size() ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+}
+
+void printUsage(const char* program) {
+	printf("usage: %s [options]\n", program);
+	printf("  -maxn <count>      largest flock in the sweep, powers of ten from 100 (default 1000000)\n");
+	printf("  -maxthreads <n>    largest thread count in the sweep (default one per core)\n");
+	printf("  -time <seconds>    minimum time per case (default 0.25)\n");
+	printf("  -format <csv|json> output format (default csv)\n");
+	printf("  -o <file>          write results to file instead of stdout\n");
+	printf("  -filter <name>     only run benchmarks whose name contains this\n");
+	printf("  -obj <file>        mesh for the indexVBO cases (default arrow.obj)\n");
+}
+
+int main(int argc, char* argv[]) {
+	int maxN = 1000000;
+	int maxThreads = (int)std::thread::hardware_concurrency();
+	const char* format = "csv";
+	const char* outPath = NULL;
+	const char* filter = "";
+	const char* objPath = "arrow.obj";
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : "";
+		if (strcmp(arg, "-h") == 0 || strcmp(arg, "-help") == 0) { printUsage(argv[0]); return 0; }
+
+		if (strcmp(arg, "-maxn") == 0) maxN = atoi(value);
+		else if (strcmp(arg, "-maxthreads") == 0) maxThreads = atoi(value);
+		else if (strcmp(arg, "-time") == 0) minSeconds = atof(value);
+		else if (strcmp(arg, "-format") == 0) format = value;
+		else if (strcmp(arg, "-o") == 0) outPath = value;
+		else if (strcmp(arg, "-filter") == 0) filter = value;
+		else if (strcmp(arg, "-obj") == 0) objPath = value;
+		else {
+			fprintf(stderr, "Unknown option %s\n", arg);
+			printUsage(argv[0]);
+			return -1;
+		}
+		i++;
+	}
+	if (strcmp(format, "csv") != 0 && strcmp(format, "json") != 0) {
+		fprintf(stderr, "Unknown format %s\n", format);
+		return -1;
+	}
+	maxThreads = std::max(maxThreads, 1);
+
+	// fixed seed so runs compare like for like
+	setSeed(1);
+	SimdName = simdLevelName(setSimdLevel(SIMD_AVX512));
+
+	std::vector<int> sizes;
+	for (long long n = 100; n <= maxN; n *= 10) sizes.push_back((int)n);
+	std::vector<int> threadCounts;
+	for (int t = 1; t < maxThreads; t *= 2) threadCounts.push_back(t);
+	threadCounts.push_back(maxThreads);
+
+	std::string only = filter;
+	if (std::string("createBoids").find(only) != std::string::npos) {
+		for (size_t i = 0; i < sizes.size(); i++) benchCreateBoids(sizes[i]);
+	}
+	if (std::string("rotateBetweenVectors").find(only) != std::string::npos) {
+		for (size_t i = 0; i < sizes.size(); i++) benchRotateBetweenVectors(sizes[i]);
+	}
+	if (std::string("threeLaws").find(only) != std::string::npos) {
+		for (size_t i = 0; i < sizes.size(); i++) {
+			benchThreeLaws(sizes[i]);
+			benchThreeLawsLists(sizes[i]);
+		}
+	}
+	if (std::string("computeBoidModelMatrices").find(only) != std::string::npos) {
+		for (size_t i = 0; i < sizes.size(); i++) {
+			for (size_t t = 0; t < threadCounts.size(); t++) {
+				benchStep(sizes[i], threadCounts[t]);
+				benchStepCompact(sizes[i], threadCounts[t]);
+				benchStepAdaptive(sizes[i], threadCounts[t]);
+				benchStepLists(sizes[i], threadCounts[t]);
+			}
+		}
+	}
+	if (std::string("cullFlock").find(only) != std::string::npos) {
+		for (size_t i = 0; i < sizes.size(); i++) {
+			for (size_t t = 0; t < threadCounts.size(); t++) benchCull(sizes[i], threadCounts[t]);
+		}
+	}
+	if (std::string("loadOBJ").find(only) != std::string::npos) {
+		for (size_t i = 0; i < sizes.size(); i++) benchLoadOBJ(sizes[i], threadCounts);
+	}
+	if (std::string("checkpoint").find(only) != std::string::npos) {
+		for (size_t i = 0; i < sizes.size(); i++) benchCheckpoint(sizes[i]);
+	}
+	if (std::string("trajectory").find(only) != std::string::npos) {
+		for (size_t i = 0; i < sizes.size(); i++) {
+			for (size_t t = 0; t < threadCounts.size(); t++) benchTrajectory(sizes[i], threadCounts[t]);
+		}
+	}
+	bool wantsIndex16 = std::string("indexVBO").find(only) != std::string::npos;
+	bool wantsIndex32 = std::string("indexVBO32").find(only) != std::string::npos;
+	if (wantsIndex16 || wantsIndex32) {
+		std::vector<glm::vec3> vertices, normals;
+		std::vector<glm::vec2> uvs;
+		// loadOBJ waits for a key press on a missing file, check first
+		FILE* objFile = fopen(objPath, "r");
+		if (objFile) fclose(objFile);
+		else fprintf(stderr, "Skipping indexVBO, can't open %s\n", objPath);
+		if (objFile && loadOBJ(objPath, vertices, uvs, normals)) {
+			// unsigned short indices cap the output at 65536 vertices
+			for (int copies = 1; wantsIndex16 && copies * vertices.size() <= 65536; copies *= 4) {
+				benchIndexVBO<unsigned short>("indexVBO", vertices, uvs, normals, copies);
+			}
+			for (int copies = 1; wantsIndex32 && copies * vertices.size() <= (size_t)maxN; copies *= 4) {
+				benchIndexVBO<unsigned int>("indexVBO32", vertices, uvs, normals, copies);
+			}
+		}
+	}
+
+	FILE* out = stdout;
+	if (outPath) {
+		out = fopen(outPath, "w");
+		if (out == NULL) {
+			fprintf(stderr, "Impossible to open %s for writing\n", outPath);
+			return -1;
+		}
+	}
+	if (strcmp(format, "json") == 0) writeJson(out);
+	else writeCsv(out);
+	if (out != stdout) fclose(out);
+
+	return 0;
+}
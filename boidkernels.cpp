@@ -0,0 +1,415 @@
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "boidkernels.hpp"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define BOIDS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC lets any function use any intrinsic, gcc/clang need the target spelled out
+#if defined(__GNUC__) || defined(__clang__)
+#define BOIDS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define BOIDS_TARGET(isa)
+#endif
+
+// reference version, same math as the original per pair loop
+static void accumulateScalar(const NeighborStreams& streams, const int* ids, const CandidateRange* ranges, int nRanges,
+	int self, glm::vec3 center, const NeighborParams& params, NeighborSums& sums) {
+	sums.totalPos = glm::vec3();
+	sums.totalVel = glm::vec3();
+	sums.totalRepel = glm::vec3();
+	sums.count = 0;
+
+	for (int r = 0; r < nRanges; r++) {
+		for (int j = ranges[r].begin; j < ranges[r].end; j++) {
+			int i = ids ? ids[j] : j;
+			if (i == self) continue;
+
+			glm::vec3 distance = glm::vec3(center.x - streams.px[i], center.y - streams.py[i], center.z - streams.pz[i]);
+			float distance2 = glm::dot(distance, distance);
+			if (distance2 < params.radius2) {
+				sums.totalPos += glm::vec3(streams.px[i], streams.py[i], streams.pz[i]);
+				sums.totalVel += glm::vec3(streams.vx[i], streams.vy[i], streams.vz[i]);
+				sums.count++;
+				// repulsion depends on distance, boids on the same spot have
+				// no direction to push apart in
+				if (distance2 > 0) sums.totalRepel += params.A * (distance / std::sqrt(distance2)) * std::exp(-distance2 * params.inverseR02);
+			}
+		}
+	}
+}
+
+#ifdef BOIDS_X86
+
+// Vector exp uses the Cephes expf scheme: x = n ln2 + r with |r| <= ln2 / 2,
+// exp(r) from a degree 5 minimax polynomial, 2^n built in the exponent bits.
+// Inputs are clamped to [-87.3, 88.3]. Over [-87, 0], the only range the
+// repulsion term feeds it, the relative error against exp() in double
+// precision stays below 1.5e-7 (about 1 ulp), far under the noise the
+// flock adds every step.
+#define EXP_HI 88.3762626647949f
+#define EXP_LO -87.3365447504019f
+#define EXP_LOG2E 1.44269504088896341f
+#define EXP_C1 0.693359375f
+#define EXP_C2 -2.12194440e-4f
+#define EXP_P0 1.9875691500e-4f
+#define EXP_P1 1.3981999507e-3f
+#define EXP_P2 8.3334519073e-3f
+#define EXP_P3 4.1665795894e-2f
+#define EXP_P4 1.6666665459e-1f
+#define EXP_P5 5.0000001201e-1f
+
+BOIDS_TARGET("sse2")
+static inline __m128 expSSE2(__m128 x) {
+	x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(EXP_LO)), _mm_set1_ps(EXP_HI));
+	__m128 fx = _mm_add_ps(_mm_mul_ps(x, _mm_set1_ps(EXP_LOG2E)), _mm_set1_ps(0.5f));
+	// floor without SSE4.1: truncate, then step down where that rounded up
+	__m128i n = _mm_cvttps_epi32(fx);
+	__m128 truncated = _mm_cvtepi32_ps(n);
+	__m128 roundedUp = _mm_cmpgt_ps(truncated, fx);
+	n = _mm_add_epi32(n, _mm_castps_si128(roundedUp));
+	fx = _mm_sub_ps(truncated, _mm_and_ps(roundedUp, _mm_set1_ps(1.0f)));
+
+	x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(EXP_C1)));
+	x = _mm_sub_ps(x, _mm_mul_ps(fx, _mm_set1_ps(EXP_C2)));
+	__m128 y = _mm_set1_ps(EXP_P0);
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P1));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P2));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P3));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P4));
+	y = _mm_add_ps(_mm_mul_ps(y, x), _mm_set1_ps(EXP_P5));
+	y = _mm_add_ps(_mm_mul_ps(y, _mm_mul_ps(x, x)), _mm_add_ps(x, _mm_set1_ps(1.0f)));
+
+	__m128i pow2n = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+	return _mm_mul_ps(y, _mm_castsi128_ps(pow2n));
+}
+
+BOIDS_TARGET("sse2")
+static inline float horizontalSum(__m128 v) {
+	__m128 shuffled = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1));
+	__m128 sums = _mm_add_ps(v, shuffled);
+	shuffled = _mm_movehl_ps(shuffled, sums);
+	return _mm_cvtss_f32(_mm_add_ss(sums, shuffled));
+}
+
+BOIDS_TARGET("sse2")
+static inline int horizontalSum(__m128i v) {
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+	v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+	return _mm_cvtsi128_si32(v);
+}
+
+// the vector kernels only take contiguous ranges, see scalarWhenIndexed
+BOIDS_TARGET("sse2")
+static void accumulateSSE2(const NeighborStreams& streams, const int*, const CandidateRange* ranges, int nRanges,
+	int self, glm::vec3 center, const NeighborParams& params, NeighborSums& sums) {
+	const __m128 cx = _mm_set1_ps(center.x), cy = _mm_set1_ps(center.y), cz = _mm_set1_ps(center.z);
+	const __m128 radius2 = _mm_set1_ps(params.radius2);
+	const __m128 negInverseR02 = _mm_set1_ps(-params.inverseR02);
+	const __m128 A = _mm_set1_ps(params.A);
+	const __m128i selfId = _mm_set1_epi32(self);
+	const __m128i laneOffsets = _mm_setr_epi32(0, 1, 2, 3);
+
+	__m128 posX = _mm_setzero_ps(), posY = _mm_setzero_ps(), posZ = _mm_setzero_ps();
+	__m128 velX = _mm_setzero_ps(), velY = _mm_setzero_ps(), velZ = _mm_setzero_ps();
+	__m128 repX = _mm_setzero_ps(), repY = _mm_setzero_ps(), repZ = _mm_setzero_ps();
+	__m128i count = _mm_setzero_si128();
+
+	for (int r = 0; r < nRanges; r++) {
+		const __m128i end = _mm_set1_epi32(ranges[r].end);
+		for (int j = ranges[r].begin; j < ranges[r].end; j += 4) {
+			__m128i lane = _mm_add_epi32(_mm_set1_epi32(j), laneOffsets);
+			__m128i inRange = _mm_cmplt_epi32(lane, end);
+			__m128 x = _mm_loadu_ps(streams.px + j);
+			__m128 y = _mm_loadu_ps(streams.py + j);
+			__m128 z = _mm_loadu_ps(streams.pz + j);
+
+			__m128 dx = _mm_sub_ps(cx, x), dy = _mm_sub_ps(cy, y), dz = _mm_sub_ps(cz, z);
+			__m128 d2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+			__m128i valid = _mm_andnot_si128(_mm_cmpeq_epi32(lane, selfId), inRange);
+			__m128 mask = _mm_and_ps(_mm_cmplt_ps(d2, radius2), _mm_castsi128_ps(valid));
+			if (_mm_movemask_ps(mask) == 0) continue;
+
+			__m128 vx = _mm_loadu_ps(streams.vx + j);
+			__m128 vy = _mm_loadu_ps(streams.vy + j);
+			__m128 vz = _mm_loadu_ps(streams.vz + j);
+
+			posX = _mm_add_ps(posX, _mm_and_ps(mask, x));
+			posY = _mm_add_ps(posY, _mm_and_ps(mask, y));
+			posZ = _mm_add_ps(posZ, _mm_and_ps(mask, z));
+			velX = _mm_add_ps(velX, _mm_and_ps(mask, vx));
+			velY = _mm_add_ps(velY, _mm_and_ps(mask, vy));
+			velZ = _mm_add_ps(velZ, _mm_and_ps(mask, vz));
+			// mask lanes are all ones, i.e. -1
+			count = _mm_sub_epi32(count, _mm_castps_si128(mask));
+
+			// A * normalize(distance) * exp(-|distance / r0|^2)
+			__m128 weight = _mm_div_ps(_mm_mul_ps(A, expSSE2(_mm_mul_ps(d2, negInverseR02))), _mm_sqrt_ps(d2));
+			weight = _mm_and_ps(_mm_and_ps(mask, _mm_cmpgt_ps(d2, _mm_setzero_ps())), weight);
+			// 0 * NaN is NaN, so slack lanes holding NaN or Inf are masked here too
+			repX = _mm_add_ps(repX, _mm_mul_ps(weight, _mm_and_ps(mask, dx)));
+			repY = _mm_add_ps(repY, _mm_mul_ps(weight, _mm_and_ps(mask, dy)));
+			repZ = _mm_add_ps(repZ, _mm_mul_ps(weight, _mm_and_ps(mask, dz)));
+		}
+	}
+
+	sums.totalPos = glm::vec3(horizontalSum(posX), horizontalSum(posY), horizontalSum(posZ));
+	sums.totalVel = glm::vec3(horizontalSum(velX), horizontalSum(velY), horizontalSum(velZ));
+	sums.totalRepel = glm::vec3(horizontalSum(repX), horizontalSum(repY), horizontalSum(repZ));
+	sums.count = horizontalSum(count);
+}
+
+BOIDS_TARGET("avx2,fma")
+static inline __m256 expAVX2(__m256 x) {
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(EXP_LO)), _mm256_set1_ps(EXP_HI));
+	__m256 fx = _mm256_floor_ps(_mm256_fmadd_ps(x, _mm256_set1_ps(EXP_LOG2E), _mm256_set1_ps(0.5f)));
+
+	x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(EXP_C1), x);
+	x = _mm256_fnmadd_ps(fx, _mm256_set1_ps(EXP_C2), x);
+	__m256 y = _mm256_set1_ps(EXP_P0);
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P1));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P2));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P3));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P4));
+	y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(EXP_P5));
+	y = _mm256_fmadd_ps(y, _mm256_mul_ps(x, x), _mm256_add_ps(x, _mm256_set1_ps(1.0f)));
+
+	__m256i pow2n = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvttps_epi32(fx), _mm256_set1_epi32(127)), 23);
+	return _mm256_mul_ps(y, _mm256_castsi256_ps(pow2n));
+}
+
+BOIDS_TARGET("avx2,fma")
+static inline float horizontalSum(__m256 v) {
+	return horizontalSum(_mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1)));
+}
+
+BOIDS_TARGET("avx2,fma")
+static inline int horizontalSum(__m256i v) {
+	return horizontalSum(_mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+}
+
+BOIDS_TARGET("avx2,fma")
+static void accumulateAVX2(const NeighborStreams& streams, const int*, const CandidateRange* ranges, int nRanges,
+	int self, glm::vec3 center, const NeighborParams& params, NeighborSums& sums) {
+	const __m256 cx = _mm256_set1_ps(center.x), cy = _mm256_set1_ps(center.y), cz = _mm256_set1_ps(center.z);
+	const __m256 radius2 = _mm256_set1_ps(params.radius2);
+	const __m256 negInverseR02 = _mm256_set1_ps(-params.inverseR02);
+	const __m256 A = _mm256_set1_ps(params.A);
+	const __m256i selfId = _mm256_set1_epi32(self);
+	const __m256i laneOffsets = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	__m256 posX = _mm256_setzero_ps(), posY = _mm256_setzero_ps(), posZ = _mm256_setzero_ps();
+	__m256 velX = _mm256_setzero_ps(), velY = _mm256_setzero_ps(), velZ = _mm256_setzero_ps();
+	__m256 repX = _mm256_setzero_ps(), repY = _mm256_setzero_ps(), repZ = _mm256_setzero_ps();
+	__m256i count = _mm256_setzero_si256();
+
+	for (int r = 0; r < nRanges; r++) {
+		const __m256i end = _mm256_set1_epi32(ranges[r].end);
+		for (int j = ranges[r].begin; j < ranges[r].end; j += 8) {
+			__m256i lane = _mm256_add_epi32(_mm256_set1_epi32(j), laneOffsets);
+			__m256i inRange = _mm256_cmpgt_epi32(end, lane);
+			__m256 x = _mm256_loadu_ps(streams.px + j);
+			__m256 y = _mm256_loadu_ps(streams.py + j);
+			__m256 z = _mm256_loadu_ps(streams.pz + j);
+
+			__m256 dx = _mm256_sub_ps(cx, x), dy = _mm256_sub_ps(cy, y), dz = _mm256_sub_ps(cz, z);
+			__m256 d2 = _mm256_fmadd_ps(dz, dz, _mm256_fmadd_ps(dy, dy, _mm256_mul_ps(dx, dx)));
+			__m256i valid = _mm256_andnot_si256(_mm256_cmpeq_epi32(lane, selfId), inRange);
+			__m256 mask = _mm256_and_ps(_mm256_cmp_ps(d2, radius2, _CMP_LT_OQ), _mm256_castsi256_ps(valid));
+			if (_mm256_movemask_ps(mask) == 0) continue;
+
+			__m256 vx = _mm256_loadu_ps(streams.vx + j);
+			__m256 vy = _mm256_loadu_ps(streams.vy + j);
+			__m256 vz = _mm256_loadu_ps(streams.vz + j);
+
+			posX = _mm256_add_ps(posX, _mm256_and_ps(mask, x));
+			posY = _mm256_add_ps(posY, _mm256_and_ps(mask, y));
+			posZ = _mm256_add_ps(posZ, _mm256_and_ps(mask, z));
+			velX = _mm256_add_ps(velX, _mm256_and_ps(mask, vx));
+			velY = _mm256_add_ps(velY, _mm256_and_ps(mask, vy));
+			velZ = _mm256_add_ps(velZ, _mm256_and_ps(mask, vz));
+			count = _mm256_sub_epi32(count, _mm256_castps_si256(mask));
+
+			__m256 weight = _mm256_div_ps(_mm256_mul_ps(A, expAVX2(_mm256_mul_ps(d2, negInverseR02))), _mm256_sqrt_ps(d2));
+			weight = _mm256_and_ps(_mm256_and_ps(mask, _mm256_cmp_ps(d2, _mm256_setzero_ps(), _CMP_GT_OQ)), weight);
+			// 0 * NaN is NaN, so slack lanes holding NaN or Inf are masked here too
+			repX = _mm256_fmadd_ps(weight, _mm256_and_ps(mask, dx), repX);
+			repY = _mm256_fmadd_ps(weight, _mm256_and_ps(mask, dy), repY);
+			repZ = _mm256_fmadd_ps(weight, _mm256_and_ps(mask, dz), repZ);
+		}
+	}
+
+	sums.totalPos = glm::vec3(horizontalSum(posX), horizontalSum(posY), horizontalSum(posZ));
+	sums.totalVel = glm::vec3(horizontalSum(velX), horizontalSum(velY), horizontalSum(velZ));
+	sums.totalRepel = glm::vec3(horizontalSum(repX), horizontalSum(repY), horizontalSum(repZ));
+	sums.count = horizontalSum(count);
+}
+
+BOIDS_TARGET("avx512f")
+static inline __m512 expAVX512(__m512 x) {
+	x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(EXP_LO)), _mm512_set1_ps(EXP_HI));
+	__m512 fx = _mm512_roundscale_ps(_mm512_fmadd_ps(x, _mm512_set1_ps(EXP_LOG2E), _mm512_set1_ps(0.5f)), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+
+	x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(EXP_C1), x);
+	x = _mm512_fnmadd_ps(fx, _mm512_set1_ps(EXP_C2), x);
+	__m512 y = _mm512_set1_ps(EXP_P0);
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P1));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P2));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P3));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P4));
+	y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(EXP_P5));
+	y = _mm512_fmadd_ps(y, _mm512_mul_ps(x, x), _mm512_add_ps(x, _mm512_set1_ps(1.0f)));
+
+	// scalef multiplies by 2^fx directly, no exponent bit fiddling needed
+	return _mm512_scalef_ps(y, fx);
+}
+
+BOIDS_TARGET("avx512f")
+static void accumulateAVX512(const NeighborStreams& streams, const int*, const CandidateRange* ranges, int nRanges,
+	int self, glm::vec3 center, const NeighborParams& params, NeighborSums& sums) {
+	const __m512 cx = _mm512_set1_ps(center.x), cy = _mm512_set1_ps(center.y), cz = _mm512_set1_ps(center.z);
+	const __m512 radius2 = _mm512_set1_ps(params.radius2);
+	const __m512 negInverseR02 = _mm512_set1_ps(-params.inverseR02);
+	const __m512 A = _mm512_set1_ps(params.A);
+	const __m512i selfId = _mm512_set1_epi32(self);
+	const __m512i laneOffsets = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	const __m512i one = _mm512_set1_epi32(1);
+
+	__m512 posX = _mm512_setzero_ps(), posY = _mm512_setzero_ps(), posZ = _mm512_setzero_ps();
+	__m512 velX = _mm512_setzero_ps(), velY = _mm512_setzero_ps(), velZ = _mm512_setzero_ps();
+	__m512 repX = _mm512_setzero_ps(), repY = _mm512_setzero_ps(), repZ = _mm512_setzero_ps();
+	__m512i count = _mm512_setzero_si512();
+
+	for (int r = 0; r < nRanges; r++) {
+		const __m512i end = _mm512_set1_epi32(ranges[r].end);
+		for (int j = ranges[r].begin; j < ranges[r].end; j += 16) {
+			__m512i lane = _mm512_add_epi32(_mm512_set1_epi32(j), laneOffsets);
+			__mmask16 inRange = _mm512_cmplt_epi32_mask(lane, end);
+
+			// masked loads never touch memory past the end of the range
+			__m512 x = _mm512_maskz_loadu_ps(inRange, streams.px + j);
+			__m512 y = _mm512_maskz_loadu_ps(inRange, streams.py + j);
+			__m512 z = _mm512_maskz_loadu_ps(inRange, streams.pz + j);
+
+			__m512 dx = _mm512_sub_ps(cx, x), dy = _mm512_sub_ps(cy, y), dz = _mm512_sub_ps(cz, z);
+			__m512 d2 = _mm512_fmadd_ps(dz, dz, _mm512_fmadd_ps(dy, dy, _mm512_mul_ps(dx, dx)));
+			__mmask16 mask = _mm512_mask_cmp_ps_mask(inRange, d2, radius2, _CMP_LT_OQ);
+			mask = _mm512_mask_cmpneq_epi32_mask(mask, lane, selfId);
+			if (mask == 0) continue;
+
+			__m512 vx = _mm512_maskz_loadu_ps(mask, streams.vx + j);
+			__m512 vy = _mm512_maskz_loadu_ps(mask, streams.vy + j);
+			__m512 vz = _mm512_maskz_loadu_ps(mask, streams.vz + j);
+
+			posX = _mm512_mask_add_ps(posX, mask, posX, x);
+			posY = _mm512_mask_add_ps(posY, mask, posY, y);
+			posZ = _mm512_mask_add_ps(posZ, mask, posZ, z);
+			velX = _mm512_add_ps(velX, vx);
+			velY = _mm512_add_ps(velY, vy);
+			velZ = _mm512_add_ps(velZ, vz);
+			count = _mm512_mask_add_epi32(count, mask, count, one);
+
+			__mmask16 apart = _mm512_mask_cmp_ps_mask(mask, d2, _mm512_setzero_ps(), _CMP_GT_OQ);
+			__m512 weight = _mm512_maskz_div_ps(apart, _mm512_mul_ps(A, expAVX512(_mm512_mul_ps(d2, negInverseR02))), _mm512_sqrt_ps(d2));
+			repX = _mm512_fmadd_ps(weight, dx, repX);
+			repY = _mm512_fmadd_ps(weight, dy, repY);
+			repZ = _mm512_fmadd_ps(weight, dz, repZ);
+		}
+	}
+
+	sums.totalPos = glm::vec3(_mm512_reduce_add_ps(posX), _mm512_reduce_add_ps(posY), _mm512_reduce_add_ps(posZ));
+	sums.totalVel = glm::vec3(_mm512_reduce_add_ps(velX), _mm512_reduce_add_ps(velY), _mm512_reduce_add_ps(velZ));
+	sums.totalRepel = glm::vec3(_mm512_reduce_add_ps(repX), _mm512_reduce_add_ps(repY), _mm512_reduce_add_ps(repZ));
+	sums.count = _mm512_reduce_add_epi32(count);
+}
+
+// Grid cells and neighbor lists reach the kernel as runs of a few ids,
+// mostly 1 to 3 per grid cell, so a vector kernel leaves most lanes
+// masked off and pays for the setup and gathers anyway. With 20000 boids
+// the vectorized grid step was 15 to 45% slower than the scalar one and
+// the list step no faster. Only the brute force scan, one long
+// contiguous range, runs vectorized
+template <NeighborKernel Contiguous>
+static void scalarWhenIndexed(const NeighborStreams& streams, const int* ids, const CandidateRange* ranges, int nRanges,
+	int self, glm::vec3 center, const NeighborParams& params, NeighborSums& sums) {
+	if (ids) accumulateScalar(streams, ids, ranges, nRanges, self, center, params, sums);
+	else Contiguous(streams, ids, ranges, nRanges, self, center, params, sums);
+}
+
+static void cpuid(int info[4], int leaf, int subleaf) {
+#ifdef _MSC_VER
+	__cpuidex(info, leaf, subleaf);
+#else
+	__asm__ __volatile__("cpuid" : "=a"(info[0]), "=b"(info[1]), "=c"(info[2]), "=d"(info[3]) : "a"(leaf), "c"(subleaf));
+#endif
+}
+
+// XCR0, tells whether the OS saves the wide registers on context switch
+static unsigned long long readXcr0() {
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int lo, hi;
+	__asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return ((unsigned long long)hi << 32) | lo;
+#endif
+}
+
+#endif
+
+SimdLevel detectSimdLevel() {
+#ifdef BOIDS_X86
+	int info[4];
+	cpuid(info, 0, 0);
+	int maxLeaf = info[0];
+
+	cpuid(info, 1, 0);
+	bool sse2 = (info[3] & (1 << 26)) != 0;
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	if (!sse2) return SIMD_SCALAR;
+	if (!osxsave || maxLeaf < 7) return SIMD_SSE2;
+
+	unsigned long long xcr0 = readXcr0();
+	bool ymmSaved = (xcr0 & 0x6) == 0x6;
+	bool zmmSaved = (xcr0 & 0xe6) == 0xe6;
+
+	cpuid(info, 7, 0);
+	bool avx2 = (info[1] & (1 << 5)) != 0;
+	bool avx512f = (info[1] & (1 << 16)) != 0;
+
+	if (avx512f && zmmSaved) return SIMD_AVX512;
+	if (avx2 && fma && ymmSaved) return SIMD_AVX2;
+	return SIMD_SSE2;
+#else
+	return SIMD_SCALAR;
+#endif
+}
+
+NeighborKernel getNeighborKernel(SimdLevel level) {
+#ifdef BOIDS_X86
+	switch (level) {
+	case SIMD_AVX512: return scalarWhenIndexed<accumulateAVX512>;
+	case SIMD_AVX2: return scalarWhenIndexed<accumulateAVX2>;
+	case SIMD_SSE2: return scalarWhenIndexed<accumulateSSE2>;
+	default: break;
+	}
+#endif
+	return accumulateScalar;
+}
+
+const char* simdLevelName(SimdLevel level) {
+	switch (level) {
+	case SIMD_AVX512: return "avx512";
+	case SIMD_AVX2: return "avx2";
+	case SIMD_SSE2: return "sse2";
+	default: return "scalar";
+	}
+}
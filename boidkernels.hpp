@@ -0,0 +1,51 @@
+#ifndef BOIDKERNELS_HPP
+#define BOIDKERNELS_HPP
+
+#include <glm/glm.hpp>
+
+#include "boids.hpp"
+#include "spatialgrid.hpp"
+
+// component arrays the neighbor scan reads from. Every array must be
+// readable up to 16 floats past its last element (see AlignedAllocator)
+struct NeighborStreams {
+	const float* px;
+	const float* py;
+	const float* pz;
+	const float* vx;
+	const float* vy;
+	const float* vz;
+};
+
+struct NeighborParams {
+	float radius2;
+	float inverseR02;
+	float A;
+};
+
+struct NeighborSums {
+	glm::vec3 totalPos;
+	glm::vec3 totalVel;
+	glm::vec3 totalRepel;
+	int count;
+};
+
+// Sums cohesion, alignment and repulsion terms for the boid at center
+// over every candidate within sqrt(radius2), skipping the boid whose id
+// is self. Without ids the ranges index the streams directly, otherwise
+// they index ids, which in turn index the streams.
+typedef void (*NeighborKernel)(
+	const NeighborStreams& streams,
+	const int* ids,
+	const CandidateRange* ranges,
+	int nRanges,
+	int self,
+	glm::vec3 center,
+	const NeighborParams& params,
+	NeighborSums& sums
+);
+
+SimdLevel detectSimdLevel();
+NeighborKernel getNeighborKernel(SimdLevel level);
+
+#endif
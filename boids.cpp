@@ -4,31 +4,54 @@
 #include <glm/gtc/quaternion.hpp>
 using namespace glm;
 
-#include <GLFW/glfw3.h>
-
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <random>
+#include <utility>
 #include <vector>
+#include "flock.hpp"
 #include "boids.hpp"
+#include "spatialgrid.hpp"
+#include "neighborlist.hpp"
+#include "boidkernels.hpp"
+#include "threadpool.hpp"
+#include "rng.hpp"
+#include "trace.hpp"
 
-Boid::Boid(glm::vec3 newPos, glm::vec3 newVel, glm::vec3 newColor) {
-	pos = newPos;
-	vel = newVel;
-	color = newColor;
-}
-
-std::vector<Boid> Boids;
+// Flock is the current state. The double buffered step reads it and
+// writes the next state into NextFlock, then the two swap
+FlockState FlockBuffers[2];
+FlockState* Flock = &FlockBuffers[0];
+FlockState* NextFlock = &FlockBuffers[1];
 std::vector<glm::mat4> ModelMatrices;
+// where the next step writes model matrices and colors, set by the renderer
+glm::mat4* ModelOutput = NULL;
+BoidInstance* CompactOutput = NULL;
+glm::vec3* ColorOutput = NULL;
 
-std::vector<glm::mat4> getModelMatrices() {
+const FlockState& getFlockState() {
+	return *Flock;
+}
+
+const std::vector<glm::mat4>& getModelMatrices() {
 	return ModelMatrices;
 }
 
-std::vector<glm::vec3> getBoidColors() {
-	std::vector<glm::vec3> colors;
-	for (int i = 0; i < Boids.size(); i++) {
-		colors.push_back(Boids[i].color);
-	}
-	return colors;
+const std::vector<glm::vec3>& getBoidColors() {
+	return Flock->colors;
+}
+
+void setInstanceOutput(glm::mat4* modelMatrices, glm::vec3* colors) {
+	ModelOutput = modelMatrices;
+	CompactOutput = NULL;
+	ColorOutput = colors;
+}
+
+void setCompactInstanceOutput(BoidInstance* instances, glm::vec3* colors) {
+	ModelOutput = NULL;
+	CompactOutput = instances;
+	ColorOutput = colors;
 }
 
 float radius = 6.0f;
@@ -43,58 +66,206 @@ float dt = 0.025f;
 // change in color between boids with many/few neighbors
 float colorChange = 15.0f;
 
-glm::vec3 noise() {
-	std::random_device rd;	// a seed source for the random number engine
-	std::mt19937 gen(rd());	// mersenne_twister_engine seeded with rd()
-	std::uniform_int_distribution<> distrib(-50, 50);
+BoidParams getBoidParams() {
+	BoidParams params;
+	params.radius = radius;
+	params.cohesion = cohesion;
+	params.noise = N;
+	params.A = A;
+	params.r0 = r0;
+	params.gravity = gravity;
+	params.dt = dt;
+	params.colorChange = colorChange;
+	return params;
+}
+
+void setBoidParams(const BoidParams& params) {
+	radius = params.radius;
+	cohesion = params.cohesion;
+	N = params.noise;
+	A = params.A;
+	r0 = params.r0;
+	gravity = params.gravity;
+	dt = params.dt;
+	colorChange = params.colorChange;
+}
+
+// neighbor lookup, brute force is kept around as a reference
+NeighborSearch neighborSearch = SPATIAL_GRID;
+SpatialGrid Grid;
+NeighborList Neighbors;
+// how much further than radius NEIGHBOR_LIST looks, boids move dt a step
+// so the default keeps the lists for about 20 steps
+float neighborSkin = 1.0f;
+
+void setNeighborSearch(NeighborSearch mode) {
+	neighborSearch = mode;
+}
+
+void setNeighborSkin(float skin) {
+	neighborSkin = skin;
+}
+
+uint64_t getNeighborListBuilds() {
+	return Neighbors.builds();
+}
+
+IntegrationMode integrationMode = DOUBLE_BUFFERED;
+
+void setIntegrationMode(IntegrationMode mode) {
+	integrationMode = mode;
+}
+
+// Per boid update rate for UPDATE_BY_ACTIVITY: a boid steers every
+// 2^RateLevel steps, staggered by its index so the work spreads evenly
+// over the steps, and IdleSteps counts the steps since it last steered.
+// Only a boid's own thread touches its entries, so they change in place
+UpdateSchedule updateSchedule = UPDATE_ALL;
+std::vector<unsigned char> RateLevel;
+std::vector<unsigned char> IdleSteps;
+std::atomic<int> steeredBoids{ 0 };
+
+void resetUpdateRates() {
+	RateLevel.assign(Flock->size(), 0);
+	IdleSteps.assign(Flock->size(), 0);
+}
+
+const std::vector<unsigned char>& getRateLevels() {
+	return RateLevel;
+}
+
+const std::vector<unsigned char>& getIdleSteps() {
+	return IdleSteps;
+}
+
+void setUpdateRates(std::vector<unsigned char> levels, std::vector<unsigned char> idle) {
+	RateLevel = std::move(levels);
+	IdleSteps = std::move(idle);
+}
+
+void setUpdateSchedule(UpdateSchedule schedule) {
+	updateSchedule = schedule;
+	resetUpdateRates();
+}
+
+int getSteeredBoidCount() {
+	return steeredBoids.load();
+}
+
+// pick the widest kernel the CPU runs at startup
+NeighborKernel neighborKernel = getNeighborKernel(detectSimdLevel());
+
+SimdLevel setSimdLevel(SimdLevel level) {
+	SimdLevel supported = detectSimdLevel();
+	if (level > supported) level = supported;
+	neighborKernel = getNeighborKernel(level);
+	return level;
+}
+
+// workers for the simulation step, created on first use. 0 = one per core
+int requestedThreads = 0;
+std::unique_ptr<ThreadPool> Pool;
+// boids handed to a thread at a time
+const int StepChunk = 256;
+
+void setThreadCount(int nThreads) {
+	requestedThreads = nThreads;
+	Pool.reset();
+}
+
+int getThreadCount() {
+	if (!Pool) Pool.reset(new ThreadPool(requestedThreads));
+	return Pool->size();
+}
+
+// every random draw is a function of (seed, step, boid), so a seed replays
+// the same flock no matter how the step is split across threads
+uint64_t seed = ((uint64_t)std::random_device()() << 32) | std::random_device()();
+uint64_t stepCount = 0;
+
+void setSeed(uint64_t newSeed) {
+	seed = newSeed;
+}
+
+uint64_t getSeed() {
+	return seed;
+}
+
+uint64_t getStepCount() {
+	return stepCount;
+}
 
-	glm::vec3 random = glm::normalize(glm::vec3(distrib(gen), distrib(gen), distrib(gen)));
-	return N * random;
+glm::vec3 noise(int boid) {
+	Philox4x32 bits = boidRandom(seed, RNG_NOISE, stepCount, boid);
+	glm::vec3 random = glm::vec3(randomSigned(bits.v[0]), randomSigned(bits.v[1]), randomSigned(bits.v[2]));
+	// an all zero draw has no direction, the odds are around 2^-72
+	if (glm::dot(random, random) == 0) random = glm::vec3(0, 1.0f, 0);
+	return N * glm::normalize(random);
 }
 
-glm::vec3 centerPull(Boid b) {
-	glm::vec3 distance = b.pos - blackHole;
+glm::vec3 centerPull(glm::vec3 pos) {
+	glm::vec3 distance = pos - blackHole;
 	return -gravity * glm::normalize(distance);
 }
 
-glm::vec3 aimFor(glm::vec3 targetPos, Boid b) {
-	return targetPos - b.pos;
+glm::vec3 aimFor(glm::vec3 targetPos, glm::vec3 pos) {
+	return targetPos - pos;
+}
+
+void prepareNeighborSearch() {
+	if (neighborSearch == SPATIAL_GRID) {
+		TRACE_SCOPE("gridBuild");
+		Grid.build(Flock->px.data(), Flock->py.data(), Flock->pz.data(), Flock->size(), radius);
+	}
+	else if (neighborSearch == NEIGHBOR_LIST) {
+		getThreadCount();
+		Neighbors.refresh(Flock->px.data(), Flock->py.data(), Flock->pz.data(), Flock->size(), radius, neighborSkin, 0, *Pool);
+	}
 }
 
-glm::vec3 threeLaws(int currIdx) {
-	int neighborCount = 0;
-	glm::vec3 totalPos = glm::vec3();
-	glm::vec3 totalVel = glm::vec3();
-	glm::vec3 totalRepel = glm::vec3();
+// flocking velocity for boid currIdx of flock. color is only written
+// when the boid has neighbors, neighborsFound always when given
+glm::vec3 threeLaws(const FlockState& flock, int currIdx, glm::vec3& color, int* neighborsFound) {
 	glm::vec3 averageVel = glm::vec3();
-	Boid& currBoid = Boids[currIdx];
-
-	for (int i = 0; i < Boids.size(); i++) {
-		if (i != currIdx) {
-			Boid b = Boids[i];
-			glm::vec3 distance = currBoid.pos - b.pos;
-			if (glm::length(distance) < radius) {
-				// if in range, compute forces
-				totalPos += b.pos;
-				totalVel += b.vel;
-				neighborCount++;
-				// repulsion depends on distance
-				glm::vec3 diff = 1 / r0 * distance;
-				float diffMag2 = glm::length2(diff);
-				totalRepel += A * glm::normalize(diff) * std::exp(-diffMag2);
-			}
-		}
+	glm::vec3 currPos = flock.position(currIdx);
+
+	// read straight from the component arrays, colors never enter the scan
+	NeighborStreams streams = {
+		flock.px.data(), flock.py.data(), flock.pz.data(),
+		flock.vx.data(), flock.vy.data(), flock.vz.data()
+	};
+	NeighborParams params = { radius * radius, 1 / (r0 * r0), A };
+	NeighborSums sums;
+
+	if (neighborSearch == SPATIAL_GRID) {
+		CandidateRange ranges[27];
+		int nRanges = Grid.candidateRanges(currPos, ranges);
+		neighborKernel(streams, Grid.indices(), ranges, nRanges, currIdx, currPos, params, sums);
 	}
+	else if (neighborSearch == NEIGHBOR_LIST) {
+		CandidateRange candidates = Neighbors.candidates(currIdx);
+		neighborKernel(streams, Neighbors.indices(), &candidates, 1, currIdx, currPos, params, sums);
+	}
+	else {
+		CandidateRange all = { 0, (int)flock.size() };
+		neighborKernel(streams, NULL, &all, 1, currIdx, currPos, params, sums);
+	}
+
+	int neighborCount = sums.count;
+	if (neighborsFound) *neighborsFound = neighborCount;
+	glm::vec3 totalPos = sums.totalPos;
+	glm::vec3 totalVel = sums.totalVel;
+	glm::vec3 totalRepel = sums.totalRepel;
 	if (neighborCount > 0) {
 		// average velocities
 		averageVel += glm::vec3(totalVel.x / neighborCount, totalVel.y / neighborCount, totalVel.z / neighborCount);
 		glm::vec3 averagePos = glm::vec3(totalPos.x / neighborCount, totalPos.y / neighborCount, totalPos.z / neighborCount);
 		// combine average with cohesive/repulsive forces
-		averageVel += cohesion * aimFor(averagePos, currBoid);
+		averageVel += cohesion * aimFor(averagePos, currPos);
 		averageVel += glm::vec3(totalRepel.x / neighborCount, totalRepel.y / neighborCount, totalRepel.z / neighborCount);
 		// change boid colors based on neighbors
-		float colorScale = Boids.size() / colorChange;
-		currBoid.color = glm::vec3(0, neighborCount / colorScale, 1 - neighborCount / colorScale);
+		float colorScale = flock.size() / colorChange;
+		color = glm::vec3(0, neighborCount / colorScale, 1 - neighborCount / colorScale);
 	}
 	return averageVel;
 }
@@ -137,43 +308,168 @@ glm::mat4 rotateBetweenVectors(vec3 srcVec, vec3 destVec) {
 }
 
 void createBoids(int nBoids) {
-	if (Boids.size() > 0) { Boids.clear(); ModelMatrices.clear(); }
-
-	std::random_device rd;
-	std::mt19937 gen(rd());
-	std::uniform_int_distribution<> distrib(-100, 100);
+	if (Flock->size() > 0) { Flock->clear(); ModelMatrices.clear(); }
+	Flock->resize(nBoids);
+	NextFlock->resize(nBoids);
+	ModelMatrices.resize(nBoids);
+	resetUpdateRates();
+	stepCount = 0;
 
 	for (int i = 0; i < nBoids; i++) {
 		// place boids at random positions around center w random velocities
-		Boid newBoid(
-			glm::vec3(distrib(gen), distrib(gen), distrib(gen)),
-			glm::normalize(glm::vec3(distrib(gen), distrib(gen), distrib(gen))),
-			glm::vec3(0, 0, 1)
-		);
-		Boids.push_back(newBoid);
-		glm::mat4 translateMatrix = glm::translate(glm::mat4(), newBoid.pos);
-		ModelMatrices.push_back(translateMatrix);
+		Philox4x32 posBits = boidRandom(seed, RNG_SPAWN, 0, i);
+		Philox4x32 velBits = boidRandom(seed, RNG_SPAWN, 1, i);
+		glm::vec3 pos = glm::vec3(randomRange(posBits.v[0], -100, 100), randomRange(posBits.v[1], -100, 100), randomRange(posBits.v[2], -100, 100));
+		glm::vec3 vel = glm::vec3(randomSigned(velBits.v[0]), randomSigned(velBits.v[1]), randomSigned(velBits.v[2]));
+		if (glm::dot(vel, vel) == 0) vel = glm::vec3(0, 1.0f, 0);
+		vel = glm::normalize(vel);
+		Flock->setPosition(i, pos);
+		Flock->setVelocity(i, vel);
+		Flock->colors[i] = glm::vec3(0, 0, 1);
+		ModelMatrices[i] = glm::translate(glm::mat4(), pos);
 	}
 }
 
-void computeBoidModelMatrices() {
+// new unit velocity from the flocking, noise and gravity terms over
+// stepDt, dt unless the boid skipped steps
+glm::vec3 steer(const FlockState& flock, int i, glm::vec3 pos, glm::vec3 vel, glm::vec3& color, float stepDt, int* neighborsFound = NULL) {
+	glm::vec3 components[3] = {
+		threeLaws(flock, i, color, neighborsFound) * stepDt,
+		noise(i) * std::sqrt(stepDt),
+		centerPull(pos) * stepDt
+	};
 
-	for (int i = 0; i < Boids.size(); i++) {
-		Boid& b = Boids[i];
-		b.pos += b.vel * dt;
+	// unit length vel
+	return glm::normalize(vel + components[0] + components[1] + components[2]);
+}
 
-		glm::vec3 components[3] = {
-			threeLaws(i) * dt,
-			noise() * std::sqrt(dt),
-			centerPull(b) * dt
-		};
+glm::mat4 boidModelMatrix(glm::vec3 pos, glm::vec3 vel) {
+	glm::mat4 translateMatrix = glm::translate(glm::mat4(), pos);
+	// rotate arrows to face the direction they're heading in
+	glm::mat4 rotationMatrix = rotateBetweenVectors(vec3(0, 1.0f, 0), vel);
+	return translateMatrix * rotationMatrix;
+}
 
-		// unit length vel
-		b.vel = glm::normalize(b.vel + components[0] + components[1] + components[2]);
+void writeCompact(BoidInstance& instance, glm::vec3 pos, glm::vec3 vel) {
+	instance.position = pos;
+	instance.heading = vel;
+}
 
-		glm::mat4 translateMatrix = glm::translate(glm::mat4(), b.pos);
-		// rotate arrows to face the direction they're heading in
-		glm::mat4 rotationMatrix = rotateBetweenVectors(vec3(0, 1.0f, 0), b.vel);
-		ModelMatrices[i] = translateMatrix * rotationMatrix;
+// Original update: each boid moves, then steers against whatever state
+// the boids before it already reached. Results depend on iteration order,
+// so this always runs on one thread
+void stepInPlace() {
+	FlockState& flock = *Flock;
+	glm::mat4* models = ModelOutput ? ModelOutput : ModelMatrices.data();
+	BoidInstance* compact = CompactOutput;
+	if (neighborSearch == SPATIAL_GRID) {
+		// bin once per step. boids move up to dt while the loop below
+		// runs, so pad the cells to keep every neighbor within reach
+		Grid.build(flock.px.data(), flock.py.data(), flock.pz.data(), flock.size(), radius + dt);
+	}
+	else if (neighborSearch == NEIGHBOR_LIST) {
+		// same for the lists, they have to last through the loop
+		Neighbors.refresh(flock.px.data(), flock.py.data(), flock.pz.data(), flock.size(), radius, neighborSkin, dt, *Pool);
+	}
+
+	for (int i = 0; i < (int)flock.size(); i++) {
+		glm::vec3 vel = flock.velocity(i);
+		glm::vec3 pos = flock.position(i) + vel * dt;
+		flock.setPosition(i, pos);
+
+		vel = steer(flock, i, pos, vel, flock.colors[i], dt);
+		flock.setVelocity(i, vel);
+		if (compact) writeCompact(compact[i], pos, vel);
+		else models[i] = boidModelMatrix(pos, vel);
+		if (ColorOutput) ColorOutput[i] = flock.colors[i];
+	}
+}
+
+// Every boid reads the same snapshot in Flock and writes only its own
+// slot of NextFlock, so boids can be updated in any order or all at once
+void stepDoubleBuffered() {
+	prepareNeighborSearch();
+	glm::mat4* models = ModelOutput ? ModelOutput : ModelMatrices.data();
+	BoidInstance* compact = CompactOutput;
+	glm::vec3* colors = ColorOutput;
+	bool scheduled = updateSchedule == UPDATE_BY_ACTIVITY;
+	steeredBoids.store(0);
+
+	Pool->parallelFor((int)Flock->size(), StepChunk, [models, compact, colors, scheduled](int begin, int end) {
+		TRACE_SCOPE("threeLaws");
+		const FlockState& front = *Flock;
+		FlockState& back = *NextFlock;
+		int steered = 0;
+		for (int i = begin; i < end; i++) {
+			glm::vec3 pos = front.position(i);
+			glm::vec3 vel = front.velocity(i);
+			glm::vec3 color = front.colors[i];
+
+			glm::vec3 newVel = vel;
+			if (!scheduled) {
+				newVel = steer(front, i, pos, vel, color, dt);
+				steered++;
+			}
+			else if ((((uint64_t)i + stepCount) & ((1u << RateLevel[i]) - 1)) == 0) {
+				// catches up on the steps it drifted through
+				int neighbors = 0;
+				newVel = steer(front, i, pos, vel, color, (IdleSteps[i] + 1) * dt, &neighbors);
+				RateLevel[i] = neighbors > 0 ? 0 : (unsigned char)std::min(RateLevel[i] + 1, MaxRateLevel);
+				IdleSteps[i] = 0;
+				steered++;
+			}
+			else {
+				IdleSteps[i]++;
+			}
+			glm::vec3 newPos = pos + vel * dt;
+
+			back.setPosition(i, newPos);
+			back.setVelocity(i, newVel);
+			back.colors[i] = color;
+			if (compact) writeCompact(compact[i], newPos, newVel);
+			else models[i] = boidModelMatrix(newPos, newVel);
+			if (colors) colors[i] = color;
+		}
+		steeredBoids.fetch_add(steered);
+	});
+
+	std::swap(Flock, NextFlock);
+}
+
+void setFlockState(FlockState state, uint64_t step) {
+	getThreadCount();
+	*Flock = std::move(state);
+	NextFlock->resize(Flock->size());
+	ModelMatrices.resize(Flock->size());
+	resetUpdateRates();
+	stepCount = step;
+
+	glm::mat4* models = ModelOutput ? ModelOutput : ModelMatrices.data();
+	BoidInstance* compact = CompactOutput;
+	glm::vec3* colors = ColorOutput;
+	Pool->parallelFor((int)Flock->size(), StepChunk, [models, compact, colors](int begin, int end) {
+		const FlockState& flock = *Flock;
+		for (int i = begin; i < end; i++) {
+			glm::vec3 pos = flock.position(i);
+			glm::vec3 vel = flock.velocity(i);
+			if (compact) writeCompact(compact[i], pos, vel);
+			else models[i] = boidModelMatrix(pos, vel);
+			if (colors) colors[i] = flock.colors[i];
+		}
+	});
+}
+
+void computeBoidModelMatrices() {
+	TRACE_SCOPE("computeBoidModelMatrices");
+	// make sure the pool exists
+	getThreadCount();
+
+	if (integrationMode == IN_PLACE) {
+		stepInPlace();
+		steeredBoids.store((int)Flock->size());
+	}
+	else {
+		stepDoubleBuffered();
 	}
+	stepCount++;
 }
\ No newline at end of file
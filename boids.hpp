@@ -1,11 +1,107 @@
-class Boid {
-public:
-	glm::vec3 pos;
-	glm::vec3 vel;
-	glm::vec3 color;
-	Boid(glm::vec3 newPos, glm::vec3 newVel, glm::vec3 newColor);
+#ifndef BOIDS_HPP
+#define BOIDS_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+struct FlockState;
+
+// NEIGHBOR_LIST keeps every boid's candidates within radius + skin from
+// step to step and only searches the grid again once some boid moved more
+// than skin / 2. Same neighbors as SPATIAL_GRID, far fewer candidates
+enum NeighborSearch { BRUTE_FORCE, SPATIAL_GRID, NEIGHBOR_LIST };
+// IN_PLACE is the original serial update where a boid sees the boids
+// before it already moved. DOUBLE_BUFFERED reads the last step and writes
+// the next, so boids are independent within a step and run in parallel
+enum IntegrationMode { IN_PLACE, DOUBLE_BUFFERED };
+// UPDATE_ALL steers every boid every step. UPDATE_BY_ACTIVITY lets a boid
+// that found no neighbors steer only every 2, 4, then 8 steps, with the
+// forces of the steps it skipped applied at once, and drift straight on
+// in between. It goes back to every step as soon as it finds a neighbor.
+// Only the double buffered step schedules, IN_PLACE always steers all
+enum UpdateSchedule { UPDATE_ALL, UPDATE_BY_ACTIVITY };
+// widest instruction set the brute force neighbor scan may use, grid
+// and list lookups always run the scalar loop
+enum SimdLevel { SIMD_SCALAR, SIMD_SSE2, SIMD_AVX2, SIMD_AVX512 };
+// what the renderer gets per boid: a full model matrix, or the
+// BoidInstance below with the rotation left to the vertex shader
+enum InstanceFormat { INSTANCE_MATRICES, INSTANCE_COMPACT };
+
+// 24 bytes instead of a 64 byte matrix. heading is the unit velocity,
+// the arrow is rotated from +y onto it
+struct BoidInstance {
+	glm::vec3 position;
+	glm::vec3 heading;
 };
+
+// tunable constants of the simulation
+struct BoidParams {
+	float radius;		// neighbor range
+	float cohesion;		// pull toward the neighbors' center
+	float noise;		// random steering
+	float A;			// repulsion strength
+	float r0;			// repulsion falloff distance
+	float gravity;		// pull toward the center of the viewport
+	float dt;			// time per step
+	float colorChange;	// color shift per neighbor, relative to flock size
+};
+
+BoidParams getBoidParams();
+void setBoidParams(const BoidParams& params);
+void setNeighborSearch(NeighborSearch mode);
+// extra range of NEIGHBOR_LIST, larger lasts more steps but lists more
+void setNeighborSkin(float skin);
+// how often NEIGHBOR_LIST searched the grid so far
+uint64_t getNeighborListBuilds();
+void setIntegrationMode(IntegrationMode mode);
+// also puts every boid back to full rate
+void setUpdateSchedule(UpdateSchedule schedule);
+// boids that steered in the last step, the whole flock unless
+// UPDATE_BY_ACTIVITY skipped some
+int getSteeredBoidCount();
+// a new neighbor is noticed at most 2^MaxRateLevel - 1 steps late
+const int MaxRateLevel = 3;
+// UPDATE_BY_ACTIVITY's state per boid: it steers every 2^level steps and
+// has skipped idle steps since it last did. Checkpoints carry both, set
+// them after setFlockState, which puts every boid back to full rate
+const std::vector<unsigned char>& getRateLevels();
+const std::vector<unsigned char>& getIdleSteps();
+void setUpdateRates(std::vector<unsigned char> levels, std::vector<unsigned char> idle);
+// clamped to what the CPU supports, returns the level actually used
+SimdLevel setSimdLevel(SimdLevel level);
+const char* simdLevelName(SimdLevel level);
+// threads the double buffered step runs on, 0 = one per core
+void setThreadCount(int nThreads);
+int getThreadCount();
+// seeds both the starting flock and the per step noise. createBoids
+// resets the step counter, so the same seed replays the same run
+void setSeed(uint64_t newSeed);
+uint64_t getSeed();
+uint64_t getStepCount();
 void createBoids(int nBoids);
-std::vector<glm::mat4> getModelMatrices();
-std::vector<glm::vec3> getBoidColors();
-void computeBoidModelMatrices();
\ No newline at end of file
+// replaces the flock with state, e.g. a recorded step, without stepping.
+// Model matrices and instance outputs are rebuilt from it. Pass an
+// rvalue to hand the arrays over instead of copying them
+void setFlockState(FlockState state, uint64_t step);
+const FlockState& getFlockState();
+const std::vector<glm::mat4>& getModelMatrices();
+const std::vector<glm::vec3>& getBoidColors();
+// steps write each boid's model matrix and color straight into these
+// arrays (one entry per boid) instead of getModelMatrices, e.g. into
+// mapped GPU memory. Stays in effect until changed, NULL goes back to
+// getModelMatrices
+void setInstanceOutput(glm::mat4* modelMatrices, glm::vec3* colors);
+// same, but steps write BoidInstances and skip building matrices
+void setCompactInstanceOutput(BoidInstance* instances, glm::vec3* colors);
+void computeBoidModelMatrices();
+
+// building blocks of a step, exposed for benchmarks.
+// prepareNeighborSearch bins the current flock for threeLaws
+void prepareNeighborSearch();
+glm::vec3 threeLaws(const FlockState& flock, int currIdx, glm::vec3& color, int* neighborsFound = NULL);
+glm::mat4 rotateBetweenVectors(glm::vec3 srcVec, glm::vec3 destVec);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,149 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "boids.hpp"
+#include "flock.hpp"
+#include "common/mappedfile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#endif
+
+// File layout: this header, then px, py, pz, vx, vy, vz as floats, the
+// colors as three floats a boid, and the rate levels and idle steps as a
+// byte a boid. The header and every array are padded to FlockAlignment,
+// like the flock's own arrays
+struct CheckpointHeader {
+	char magic[4];			// "BCKP"
+	uint32_t version;		// CheckpointVersion
+	uint64_t boidCount;
+	uint64_t seed;
+	uint64_t step;
+	// BoidParams field by field, so the layout never follows the struct
+	float radius;
+	float cohesion;
+	float noise;
+	float A;
+	float r0;
+	float gravity;
+	float dt;
+	float colorChange;
+};
+
+static const char CheckpointMagic[4] = { 'B', 'C', 'K', 'P' };
+
+static uint64_t padded(uint64_t bytes) {
+	return (bytes + FlockAlignment - 1) / FlockAlignment * FlockAlignment;
+}
+
+static uint64_t checkpointSize(uint64_t boids) {
+	return padded(sizeof(CheckpointHeader)) + 6 * padded(boids * sizeof(float)) + padded(boids * sizeof(glm::vec3)) + 2 * padded(boids);
+}
+
+// data plus zeros up to the next FlockAlignment boundary
+static bool writePadded(FILE* file, const void* data, size_t bytes) {
+	static const char zeros[FlockAlignment] = {};
+	size_t padding = (size_t)(padded(bytes) - bytes);
+	return (bytes == 0 || fwrite(data, bytes, 1, file) == 1) &&
+		(padding == 0 || fwrite(zeros, padding, 1, file) == 1);
+}
+
+bool saveCheckpoint(const char* path) {
+	const FlockState& flock = getFlockState();
+	BoidParams params = getBoidParams();
+	size_t n = flock.size();
+
+	CheckpointHeader header = {};
+	memcpy(header.magic, CheckpointMagic, 4);
+	header.version = CheckpointVersion;
+	header.boidCount = n;
+	header.seed = getSeed();
+	header.step = getStepCount();
+	header.radius = params.radius;
+	header.cohesion = params.cohesion;
+	header.noise = params.noise;
+	header.A = params.A;
+	header.r0 = params.r0;
+	header.gravity = params.gravity;
+	header.dt = params.dt;
+	header.colorChange = params.colorChange;
+
+	std::string tempPath = std::string(path) + ".tmp";
+	FILE* file = fopen(tempPath.c_str(), "wb");
+	if (file == NULL) return false;
+	const float* arrays[6] = { flock.px.data(), flock.py.data(), flock.pz.data(), flock.vx.data(), flock.vy.data(), flock.vz.data() };
+	bool written = writePadded(file, &header, sizeof(header));
+	for (int a = 0; a < 6; a++) written = written && writePadded(file, arrays[a], n * sizeof(float));
+	written = written && writePadded(file, flock.colors.data(), n * sizeof(glm::vec3));
+	written = written && writePadded(file, getRateLevels().data(), n);
+	written = written && writePadded(file, getIdleSteps().data(), n);
+	written = fclose(file) == 0 && written;
+
+	// replaced in one step, never a moment without a checkpoint
+	if (written) {
+#ifdef _WIN32
+		written = MoveFileExA(tempPath.c_str(), path, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+		written = rename(tempPath.c_str(), path) == 0;
+#endif
+	}
+	if (!written) remove(tempPath.c_str());
+	return written;
+}
+
+bool loadCheckpoint(const char* path) {
+	MappedFile file;
+	if (!file.open(path)) return false;
+
+	CheckpointHeader header;
+	if (file.size() < sizeof(header)) return false;
+	memcpy(&header, file.data(), sizeof(header));
+	bool valid = memcmp(header.magic, CheckpointMagic, 4) == 0 &&
+		header.version == CheckpointVersion &&
+		// createBoids and the step index boids with an int
+		header.boidCount <= 0x7fffffff &&
+		file.size() == checkpointSize(header.boidCount);
+	if (!valid) return false;
+
+	size_t n = (size_t)header.boidCount;
+	FlockState state;
+	state.resize(n);
+	std::vector<unsigned char> levels(n), idle(n);
+	if (n > 0) {
+		float* arrays[6] = { state.px.data(), state.py.data(), state.pz.data(), state.vx.data(), state.vy.data(), state.vz.data() };
+		const char* at = file.data() + padded(sizeof(header));
+		for (int a = 0; a < 6; a++) {
+			memcpy(arrays[a], at, n * sizeof(float));
+			at += padded(n * sizeof(float));
+		}
+		memcpy(state.colors.data(), at, n * sizeof(glm::vec3));
+		at += padded(n * sizeof(glm::vec3));
+		memcpy(levels.data(), at, n);
+		memcpy(idle.data(), at + padded(n), n);
+	}
+	// a level past MaxRateLevel would shift the step mask out of range
+	for (size_t i = 0; i < n; i++) {
+		if (levels[i] > MaxRateLevel) return false;
+	}
+
+	BoidParams params;
+	params.radius = header.radius;
+	params.cohesion = header.cohesion;
+	params.noise = header.noise;
+	params.A = header.A;
+	params.r0 = header.r0;
+	params.gravity = header.gravity;
+	params.dt = header.dt;
+	params.colorChange = header.colorChange;
+	setBoidParams(params);
+	setSeed(header.seed);
+	setFlockState(std::move(state), header.step);
+	setUpdateRates(std::move(levels), std::move(idle));
+	return true;
+}
@@ -0,0 +1,23 @@
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cstdint>
+
+// bump whenever the layout changes, older checkpoints are refused
+const uint32_t CheckpointVersion = 2;
+
+// Writes the whole simulation state: every boid at full precision with
+// its UPDATE_BY_ACTIVITY rate, the parameters, the seed and the step
+// counter. Every random draw is a function of (seed, step, boid), so a
+// restored run goes on exactly as the saved one would have. The file is
+// written aside and renamed over, a crash while saving leaves the last
+// checkpoint intact. False on any I/O error
+bool saveCheckpoint(const char* path);
+
+// Replaces the flock, rates, parameters, seed and step counter with a checkpoint
+// from saveCheckpoint, copied straight out of a mapping of the file.
+// False, with nothing changed, if the file is missing, incomplete or of
+// another version
+bool loadCheckpoint(const char* path);
+
+#endif
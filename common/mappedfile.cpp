@@ -0,0 +1,84 @@
+#include "mappedfile.hpp"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+bool MappedFile::open(const char* path) {
+	close();
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize)) {
+		CloseHandle(file);
+		return false;
+	}
+	fileHandle = file;
+	opened = true;
+	length = (size_t)fileSize.QuadPart;
+	// a zero length file can't be mapped, it simply has no data
+	if (length == 0) return true;
+
+	mappingHandle = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mappingHandle != NULL) mapped = (const char*)MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (mapped == NULL) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::close() {
+	if (mapped) UnmapViewOfFile(mapped);
+	if (mappingHandle) CloseHandle(mappingHandle);
+	if (fileHandle) CloseHandle(fileHandle);
+	mapped = nullptr;
+	mappingHandle = fileHandle = nullptr;
+	length = 0;
+	opened = false;
+}
+
+#else
+
+bool MappedFile::open(const char* path) {
+	close();
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat info;
+	if (fstat(fd, &info) != 0) {
+		::close(fd);
+		return false;
+	}
+	length = (size_t)info.st_size;
+	if (length > 0) {
+		void* view = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view == MAP_FAILED) {
+			::close(fd);
+			length = 0;
+			return false;
+		}
+		mapped = (const char*)view;
+	}
+	// the mapping keeps the file alive on its own
+	::close(fd);
+	opened = true;
+	return true;
+}
+
+void MappedFile::close() {
+	if (mapped) munmap((void*)mapped, length);
+	mapped = nullptr;
+	length = 0;
+	opened = false;
+}
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef MAPPEDFILE_HPP
+#define MAPPEDFILE_HPP
+
+#include <cstddef>
+
+// Read only view of a whole file through the OS page cache, nothing is
+// copied or parsed up front. Valid until close or destruction
+class MappedFile {
+public:
+	MappedFile() {}
+	~MappedFile() { close(); }
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// false if the file can't be opened or mapped. An empty file opens
+	// with size 0 and a null data pointer
+	bool open(const char* path);
+	void close();
+
+	const char* data() const { return mapped; }
+	size_t size() const { return length; }
+	bool isOpen() const { return opened; }
+
+private:
+	const char* mapped = nullptr;
+	size_t length = 0;
+	bool opened = false;
+#ifdef _WIN32
+	void* fileHandle = nullptr;
+	void* mappingHandle = nullptr;
+#endif
+};
+
+#endif
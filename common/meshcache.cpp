@@ -0,0 +1,166 @@
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include <glm/glm.hpp>
+
+#include "meshcache.hpp"
+#include "objloader.hpp"
+#include "vboindexer.hpp"
+
+// File layout: this header, vertexCount MeshVertex, then indexCount
+// indices of indexSize bytes. The header is 48 bytes and a vertex 24, so
+// both arrays stay aligned for direct use from the mapping
+struct MeshCacheHeader {
+	char magic[4];			// "BMSH"
+	uint32_t version;		// MeshCacheVersion
+	uint32_t vertexStride;	// sizeof(MeshVertex)
+	uint32_t indexSize;
+	uint64_t vertexCount;
+	uint64_t indexCount;
+	// size and modification time of the OBJ the cache was built from
+	int64_t sourceSize;
+	int64_t sourceTime;
+};
+
+static const char MeshCacheMagic[4] = { 'B', 'M', 'S', 'H' };
+
+// false if path doesn't exist
+static bool sourceStamp(const char * path, long long & size, long long & time){
+#ifdef _WIN32
+	struct _stat64 info;
+	if (_stat64(path, &info) != 0) return false;
+#else
+	struct stat info;
+	if (stat(path, &info) != 0) return false;
+#endif
+	size = (long long)info.st_size;
+	time = (long long)info.st_mtime;
+	return true;
+}
+
+void buildMesh(
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals,
+	MeshData & mesh
+){
+	std::vector<unsigned int> indices;
+	std::vector<glm::vec3> indexed_vertices;
+	std::vector<glm::vec2> indexed_uvs;
+	std::vector<glm::vec3> indexed_normals;
+	indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
+
+	mesh.file.close();
+	mesh.ownedVertices.resize(indexed_vertices.size());
+	for (size_t i = 0; i < indexed_vertices.size(); i++) {
+		mesh.ownedVertices[i].position = indexed_vertices[i];
+		mesh.ownedVertices[i].normal = indexed_normals[i];
+	}
+	// 16 bit indices whenever they can address every vertex
+	mesh.indexSize = indexed_vertices.size() <= 65536 ? 2 : 4;
+	mesh.ownedIndices.resize(indices.size() * mesh.indexSize);
+	if (mesh.indexSize == 2) {
+		unsigned short * shortIndices = (unsigned short *)mesh.ownedIndices.data();
+		for (size_t i = 0; i < indices.size(); i++) shortIndices[i] = (unsigned short)indices[i];
+	} else if (!indices.empty()) {
+		memcpy(mesh.ownedIndices.data(), indices.data(), mesh.ownedIndices.size());
+	}
+
+	mesh.vertices = mesh.ownedVertices.data();
+	mesh.vertexCount = mesh.ownedVertices.size();
+	mesh.indices = mesh.ownedIndices.data();
+	mesh.indexCount = indices.size();
+}
+
+// maps cachePath into mesh if it is a complete cache of the current
+// version, and built from the given source when there is one
+static bool openMeshCache(const char * cachePath, MeshData & mesh, bool haveSource, long long sourceSize, long long sourceTime){
+	if (!mesh.file.open(cachePath)) return false;
+
+	MeshCacheHeader header;
+	bool valid = mesh.file.size() >= sizeof(header);
+	if (valid) {
+		memcpy(&header, mesh.file.data(), sizeof(header));
+		valid = memcmp(header.magic, MeshCacheMagic, 4) == 0 &&
+			header.version == MeshCacheVersion &&
+			header.vertexStride == sizeof(MeshVertex) &&
+			(header.indexSize == 2 || header.indexSize == 4) &&
+			mesh.file.size() == sizeof(header) + header.vertexCount * sizeof(MeshVertex) + header.indexCount * header.indexSize;
+	}
+	// a missing OBJ leaves the cache as the only copy, use it
+	if (valid && haveSource) {
+		valid = header.sourceSize == sourceSize && header.sourceTime == sourceTime;
+	}
+	if (!valid) {
+		mesh.file.close();
+		return false;
+	}
+
+	mesh.ownedVertices.clear();
+	mesh.ownedIndices.clear();
+	mesh.vertices = (const MeshVertex*)(mesh.file.data() + sizeof(header));
+	mesh.vertexCount = (size_t)header.vertexCount;
+	mesh.indices = mesh.file.data() + sizeof(header) + header.vertexCount * sizeof(MeshVertex);
+	mesh.indexCount = (size_t)header.indexCount;
+	mesh.indexSize = header.indexSize;
+	return true;
+}
+
+bool writeMeshCache(const char * cachePath, const MeshData & mesh, long long sourceSize, long long sourceTime){
+	MeshCacheHeader header;
+	memcpy(header.magic, MeshCacheMagic, 4);
+	header.version = MeshCacheVersion;
+	header.vertexStride = sizeof(MeshVertex);
+	header.indexSize = mesh.indexSize;
+	header.vertexCount = mesh.vertexCount;
+	header.indexCount = mesh.indexCount;
+	header.sourceSize = sourceSize;
+	header.sourceTime = sourceTime;
+
+	// written aside and renamed over, so a crash never leaves half a cache
+	std::string tempPath = std::string(cachePath) + ".tmp";
+	FILE * file = fopen(tempPath.c_str(), "wb");
+	if (file == NULL) return false;
+	bool written =
+		fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(mesh.vertices, sizeof(MeshVertex), mesh.vertexCount, file) == mesh.vertexCount &&
+		fwrite(mesh.indices, mesh.indexSize, mesh.indexCount, file) == mesh.indexCount;
+	written = fclose(file) == 0 && written;
+	if (written) {
+		remove(cachePath);
+		written = rename(tempPath.c_str(), cachePath) == 0;
+	}
+	if (!written) remove(tempPath.c_str());
+	return written;
+}
+
+bool loadMeshCached(const char * path, MeshData & mesh){
+	std::string cachePath = std::string(path) + ".meshcache";
+	long long sourceSize = 0, sourceTime = 0;
+	bool haveSource = sourceStamp(path, sourceSize, sourceTime);
+
+	if (openMeshCache(cachePath.c_str(), mesh, haveSource, sourceSize, sourceTime)) {
+		printf("Loaded mesh cache %s\n", cachePath.c_str());
+		return true;
+	}
+	if (!haveSource) {
+		printf("Impossible to open %s\n", path);
+		return false;
+	}
+
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	if (!loadOBJParallel(path, vertices, uvs, normals)) return false;
+	buildMesh(vertices, uvs, normals, mesh);
+	// a read only asset directory just means parsing again next time
+	if (writeMeshCache(cachePath.c_str(), mesh, sourceSize, sourceTime)) {
+		printf("Wrote mesh cache %s\n", cachePath.c_str());
+	}
+	return true;
+}
@@ -0,0 +1,53 @@
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "mappedfile.hpp"
+
+// bump whenever the layout below changes, older caches are rebuilt
+const unsigned int MeshCacheVersion = 1;
+
+// one interleaved vertex, what the boid shaders read. No UVs, nothing
+// samples a texture
+struct MeshVertex {
+	glm::vec3 position;
+	glm::vec3 normal;
+};
+
+// An indexed mesh ready for glBufferData, pointing either into a mapped
+// cache file or into its own arrays
+struct MeshData {
+	const MeshVertex* vertices = nullptr;
+	size_t vertexCount = 0;
+	const void* indices = nullptr;
+	size_t indexCount = 0;
+	// bytes per index, 2 or 4
+	unsigned int indexSize = 2;
+
+	MappedFile file;
+	std::vector<MeshVertex> ownedVertices;
+	std::vector<unsigned char> ownedIndices;
+};
+
+// indexes and interleaves unindexed triangles, uvs are dropped
+void buildMesh(
+	std::vector<glm::vec3> & vertices,
+	std::vector<glm::vec2> & uvs,
+	std::vector<glm::vec3> & normals,
+	MeshData & mesh
+);
+
+// Loads the OBJ at path through a binary cache next to it (path +
+// ".meshcache"). The cache is mapped as is when it was built from an OBJ
+// of the same size and modification time, otherwise the OBJ is parsed,
+// indexed and the cache rewritten
+bool loadMeshCached(const char * path, MeshData & mesh);
+
+// writes mesh in the cache format, false on any I/O error
+bool writeMeshCache(const char * cachePath, const MeshData & mesh, long long sourceSize, long long sourceTime);
+
+#endif
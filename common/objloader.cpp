@@ -2,10 +2,15 @@
 #include <stdio.h>
 #include <string>
 #include <cstring>
+#include <climits>
+#include <algorithm>
+#include <charconv>
+#include <thread>
 
 #include <glm/glm.hpp>
 
 #include "objloader.hpp"
+#include "mappedfile.hpp"
 
 // Very, VERY simple OBJ loader.
 // Here is a short list of features a real function would provide : 
@@ -111,6 +116,290 @@ bool loadOBJ(
 }
 
 
+// Corner indices are 0 based. Absolute ones index the whole file's
+// arrays. Negative (relative) ones may reach back into earlier chunks,
+// so they are kept relative to the start of their chunk, flagged in
+// relative, and resolved once the chunks are merged
+static const int MissingIndex = INT_MIN;
+enum { RelativeVertex = 1, RelativeUv = 2, RelativeNormal = 4 };
+
+struct ObjCorner{
+	int vertex, uv, normal;
+	unsigned char relative;
+};
+
+// one line aligned slice of the file, parsed on its own thread
+struct ObjChunk{
+	const char * begin;
+	const char * end;
+	std::vector<glm::vec3> vertices;
+	std::vector<glm::vec2> uvs;
+	std::vector<glm::vec3> normals;
+	// three corners per triangle
+	std::vector<ObjCorner> corners;
+	int lines = 0;
+	// line within the chunk of the first error, 0 if none
+	int errorLine = 0;
+	const char * error = NULL;
+};
+
+static const char * skipSpaces(const char * p, const char * end){
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+	return p;
+}
+
+static bool parseFloat(const char * & p, const char * end, float & value){
+	p = skipSpaces(p, end);
+	// from_chars takes no leading +
+	if (p < end && *p == '+') p++;
+	std::from_chars_result result = std::from_chars(p, end, value);
+	if (result.ec != std::errc()) return false;
+	p = result.ptr;
+	return true;
+}
+
+static bool parseFloats(const char * & p, const char * end, float * values, int count){
+	for (int i = 0; i < count; i++){
+		if (!parseFloat(p, end, values[i])) return false;
+	}
+	return true;
+}
+
+// one OBJ index, 1 based or negative, to the encoding above. count is
+// how many of that attribute the chunk has read so far
+static bool parseIndex(const char * & p, const char * end, size_t count, int & index, bool & relative){
+	int value;
+	std::from_chars_result result = std::from_chars(p, end, value);
+	if (result.ec != std::errc() || value == 0) return false;
+	p = result.ptr;
+	relative = value < 0;
+	index = relative ? (int)count + value : value - 1;
+	return true;
+}
+
+// v, v/vt, v//vn or v/vt/vn
+static bool parseCorner(const char * & p, const char * end, const ObjChunk & chunk, ObjCorner & corner){
+	corner.uv = corner.normal = MissingIndex;
+	corner.relative = 0;
+	bool relative;
+	if (!parseIndex(p, end, chunk.vertices.size(), corner.vertex, relative)) return false;
+	if (relative) corner.relative |= RelativeVertex;
+	if (p < end && *p == '/'){
+		p++;
+		if (p < end && *p != '/'){
+			if (!parseIndex(p, end, chunk.uvs.size(), corner.uv, relative)) return false;
+			if (relative) corner.relative |= RelativeUv;
+		}
+		if (p < end && *p == '/'){
+			p++;
+			if (!parseIndex(p, end, chunk.normals.size(), corner.normal, relative)) return false;
+			if (relative) corner.relative |= RelativeNormal;
+		}
+	}
+	return true;
+}
+
+static const char * parseLine(const char * p, const char * end, ObjChunk & chunk, std::vector<ObjCorner> & polygon){
+	p = skipSpaces(p, end);
+	if (p == end || *p == '#') return NULL;
+	const char * keyword = p;
+	while (p < end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+	size_t length = p - keyword;
+
+	if (length == 1 && keyword[0] == 'v'){
+		glm::vec3 vertex;
+		if (!parseFloats(p, end, &vertex.x, 3)) return "bad vertex";
+		chunk.vertices.push_back(vertex);
+	}else if (length == 2 && keyword[0] == 'v' && keyword[1] == 't'){
+		glm::vec2 uv(0.0f);
+		// v is optional
+		if (!parseFloat(p, end, uv.x)) return "bad uv";
+		parseFloat(p, end, uv.y);
+		uv.y = -uv.y; // inverted like loadOBJ does for DDS textures
+		chunk.uvs.push_back(uv);
+	}else if (length == 2 && keyword[0] == 'v' && keyword[1] == 'n'){
+		glm::vec3 normal;
+		if (!parseFloats(p, end, &normal.x, 3)) return "bad normal";
+		chunk.normals.push_back(normal);
+	}else if (length == 1 && keyword[0] == 'f'){
+		polygon.clear();
+		for (p = skipSpaces(p, end); p < end && *p != '#'; p = skipSpaces(p, end)){
+			ObjCorner corner;
+			if (!parseCorner(p, end, chunk, corner)) return "bad face";
+			polygon.push_back(corner);
+		}
+		if (polygon.size() < 3) return "face with fewer than 3 corners";
+		// fan from the first corner, fine for the convex polygons exporters write
+		for (size_t i = 1; i + 1 < polygon.size(); i++){
+			chunk.corners.push_back(polygon[0]);
+			chunk.corners.push_back(polygon[i]);
+			chunk.corners.push_back(polygon[i + 1]);
+		}
+	}
+	// anything else (o, g, s, usemtl, mtllib, l, ...) doesn't affect the mesh
+	return NULL;
+}
+
+static void parseChunk(ObjChunk & chunk){
+	std::vector<ObjCorner> polygon;
+	const char * p = chunk.begin;
+	while (p < chunk.end){
+		const char * lineEnd = (const char *)memchr(p, '\n', chunk.end - p);
+		if (lineEnd == NULL) lineEnd = chunk.end;
+		chunk.lines++;
+		const char * error = parseLine(p, lineEnd, chunk, polygon);
+		if (error != NULL){
+			chunk.error = error;
+			chunk.errorLine = chunk.lines;
+			return;
+		}
+		p = lineEnd + 1;
+	}
+}
+
+// body(i) for i in [0, count), on up to count threads including this one
+template <typename Body>
+static void runParallel(int count, Body body){
+	std::vector<std::thread> threads;
+	for (int i = 1; i < count; i++) threads.push_back(std::thread(body, i));
+	if (count > 0) body(0);
+	for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+}
+
+// corner index to an index into the whole file's array, offset is where
+// the chunk's own entries start. False if out of range
+static bool resolveIndex(int index, bool relative, size_t offset, size_t total, size_t & result){
+	long long resolved = relative ? (long long)offset + index : index;
+	result = (size_t)resolved;
+	return resolved >= 0 && result < total;
+}
+
+bool loadOBJParallel(
+	const char * path,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	int nThreads
+){
+	MappedFile file;
+	if (!file.open(path)){
+		printf("Impossible to open %s\n", path);
+		return false;
+	}
+	const char * data = file.data();
+	size_t size = file.size();
+
+	// chunks of at least 256KB so small files stay on one thread, cut
+	// right after a newline
+	if (nThreads <= 0) nThreads = std::max(1u, std::thread::hardware_concurrency());
+	const size_t MinChunkBytes = 256 * 1024;
+	int nChunks = (int)std::max<size_t>(1, std::min<size_t>(nThreads, size / MinChunkBytes));
+	std::vector<ObjChunk> chunks(nChunks);
+	const char * begin = data;
+	for (int c = 0; c < nChunks; c++){
+		const char * end = data + size * (c + 1) / nChunks;
+		if (c + 1 < nChunks){
+			const char * newline = end > begin ? (const char *)memchr(end - 1, '\n', data + size - (end - 1)) : NULL;
+			end = newline != NULL ? newline + 1 : data + size;
+		}else{
+			end = data + size;
+		}
+		chunks[c].begin = begin;
+		chunks[c].end = std::max(begin, end);
+		begin = chunks[c].end;
+	}
+
+	runParallel(nChunks, [&chunks](int c){ parseChunk(chunks[c]); });
+
+	// where each chunk's attributes and triangles start in the merged arrays
+	std::vector<size_t> vertexOffset(nChunks + 1, 0), uvOffset(nChunks + 1, 0), normalOffset(nChunks + 1, 0), cornerOffset(nChunks + 1, 0);
+	int line = 0;
+	for (int c = 0; c < nChunks; c++){
+		if (chunks[c].error != NULL){
+			printf("%s line %d: %s\n", path, line + chunks[c].errorLine, chunks[c].error);
+			return false;
+		}
+		line += chunks[c].lines;
+		vertexOffset[c + 1] = vertexOffset[c] + chunks[c].vertices.size();
+		uvOffset[c + 1] = uvOffset[c] + chunks[c].uvs.size();
+		normalOffset[c + 1] = normalOffset[c] + chunks[c].normals.size();
+		cornerOffset[c + 1] = cornerOffset[c] + chunks[c].corners.size();
+	}
+
+	std::vector<glm::vec3> vertices, normals;
+	std::vector<glm::vec2> uvs;
+	vertices.reserve(vertexOffset[nChunks]);
+	uvs.reserve(uvOffset[nChunks]);
+	normals.reserve(normalOffset[nChunks]);
+	for (int c = 0; c < nChunks; c++){
+		vertices.insert(vertices.end(), chunks[c].vertices.begin(), chunks[c].vertices.end());
+		uvs.insert(uvs.end(), chunks[c].uvs.begin(), chunks[c].uvs.end());
+		normals.insert(normals.end(), chunks[c].normals.begin(), chunks[c].normals.end());
+	}
+
+	size_t first = out_vertices.size();
+	size_t nCorners = cornerOffset[nChunks];
+	out_vertices.resize(first + nCorners);
+	out_uvs.resize(first + nCorners);
+	out_normals.resize(first + nCorners);
+
+	// every chunk writes its own triangles
+	std::vector<char> failed(nChunks, 0);
+	runParallel(nChunks, [&](int c){
+		const std::vector<ObjCorner> & corners = chunks[c].corners;
+		size_t out = first + cornerOffset[c];
+		for (size_t i = 0; i < corners.size(); i += 3){
+			size_t vertexIndex[3];
+			for (int k = 0; k < 3; k++){
+				if (!resolveIndex(corners[i + k].vertex, (corners[i + k].relative & RelativeVertex) != 0, vertexOffset[c], vertices.size(), vertexIndex[k])){
+					failed[c] = 1;
+					return;
+				}
+				out_vertices[out + k] = vertices[vertexIndex[k]];
+			}
+			// flat normal for corners that don't name one
+			glm::vec3 faceNormal(0.0f);
+			for (int k = 0; k < 3; k++){
+				const ObjCorner & corner = corners[i + k];
+				size_t index;
+				if (corner.uv == MissingIndex){
+					out_uvs[out + k] = glm::vec2(0.0f);
+				}else if (resolveIndex(corner.uv, (corner.relative & RelativeUv) != 0, uvOffset[c], uvs.size(), index)){
+					out_uvs[out + k] = uvs[index];
+				}else{
+					failed[c] = 1;
+					return;
+				}
+				if (corner.normal == MissingIndex){
+					if (faceNormal == glm::vec3(0.0f)){
+						glm::vec3 cross = glm::cross(out_vertices[out + 1] - out_vertices[out], out_vertices[out + 2] - out_vertices[out]);
+						float length = glm::length(cross);
+						faceNormal = length > 0 ? cross / length : glm::vec3(0, 0, 1);
+					}
+					out_normals[out + k] = faceNormal;
+				}else if (resolveIndex(corner.normal, (corner.relative & RelativeNormal) != 0, normalOffset[c], normals.size(), index)){
+					out_normals[out + k] = normals[index];
+				}else{
+					failed[c] = 1;
+					return;
+				}
+			}
+			out += 3;
+		}
+	});
+	for (int c = 0; c < nChunks; c++){
+		if (failed[c]){
+			printf("%s: face index out of range\n", path);
+			out_vertices.resize(first);
+			out_uvs.resize(first);
+			out_normals.resize(first);
+			return false;
+		}
+	}
+	return true;
+}
+
+
 #ifdef USE_ASSIMP // don't use this #define, it's only for me (it AssImp fails to compile on your machine, at least all the other tutorials still work)
 
 // Include AssImp
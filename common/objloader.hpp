@@ -8,7 +8,20 @@ bool loadOBJ(
 	std::vector<glm::vec3> & out_normals
 );
 
-
+// Faster and more lenient loadOBJ for big meshes. The file is mapped
+// and parsed in line aligned chunks on nThreads threads (0 means one per
+// core), numbers with std::from_chars. Same output, one entry per
+// triangle corner, but faces may also use v, v/vt and v//vn corners,
+// negative (relative) indices and more than three corners, which are
+// split into a fan. Corners without a uv get (0,0), without a normal the
+// triangle's flat normal. Prints nothing unless the file is bad
+bool loadOBJParallel(
+	const char * path,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	int nThreads = 0
+);
 
 bool loadAssImp(
 	const char * path, 
@@ -7,50 +7,188 @@
 #include <sstream>
 using namespace std;
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
 
 #include <GL/glew.h>
 
 #include "shader.hpp"
 
-GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+// Program binaries are cached in ShaderCacheDirectory, one file per
+// source hash: this header, then the driver's binary. The driver hash
+// covers vendor, renderer and version strings, so a driver update or
+// another GPU just relinks from source and rewrites the file
+struct ProgramCacheHeader {
+	char magic[4];				// "BPRG"
+	uint32_t version;			// ProgramCacheVersion
+	uint64_t sourceHash;
+	uint64_t driverHash;
+	uint32_t binaryFormat;
+	uint32_t binaryLength;
+};
 
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+static const char ProgramCacheMagic[4] = { 'B', 'P', 'R', 'G' };
+static const uint32_t ProgramCacheVersion = 1;
+static const char * ShaderCacheDirectory = "shadercache";
 
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if(VertexShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
-	}else{
-		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
-		getchar();
+// 64 bit FNV-1a, chained through hash
+static uint64_t hashBytes(const void * data, size_t length, uint64_t hash = 14695981039346656037ull){
+	const unsigned char * bytes = (const unsigned char *)data;
+	for (size_t i = 0; i < length; i++) hash = (hash ^ bytes[i]) * 1099511628211ull;
+	return hash;
+}
+
+static bool readFile(const char * path, std::string & contents){
+	std::ifstream stream(path, std::ios::in | std::ios::binary);
+	if (!stream.is_open()) return false;
+	std::stringstream sstr;
+	sstr << stream.rdbuf();
+	contents = sstr.str();
+	return true;
+}
+
+static std::string programCachePath(uint64_t sourceHash){
+	char name[64];
+	snprintf(name, sizeof(name), "%s/%016llx.programbinary", ShaderCacheDirectory, (unsigned long long)sourceHash);
+	return name;
+}
+
+// needs GL 4.1 or ARB_get_program_binary, and a driver that offers at
+// least one binary format
+static bool programBinariesSupported(){
+	if (!GLEW_VERSION_4_1 && !GLEW_ARB_get_program_binary) return false;
+	GLint formats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	return formats > 0;
+}
+
+static uint64_t driverHash(){
+	GLenum names[3] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+	uint64_t hash = hashBytes(NULL, 0);
+	for (int i = 0; i < 3; i++){
+		const char * value = (const char *)glGetString(names[i]);
+		if (value != NULL) hash = hashBytes(value, strlen(value) + 1, hash);
+	}
+	return hash;
+}
+
+// the program stored in cache, 0 if it is for other sources or another
+// driver, or the driver rejects it
+static GLuint loadProgramBinary(const std::vector<char> & cache, uint64_t sourceHash){
+	ProgramCacheHeader header;
+	if (cache.size() < sizeof(header) || !programBinariesSupported()) return 0;
+	memcpy(&header, cache.data(), sizeof(header));
+	if (memcmp(header.magic, ProgramCacheMagic, 4) != 0 ||
+		header.version != ProgramCacheVersion ||
+		header.sourceHash != sourceHash ||
+		header.driverHash != driverHash() ||
+		cache.size() != sizeof(header) + header.binaryLength) return 0;
+
+	GLuint ProgramID = glCreateProgram();
+	glProgramBinary(ProgramID, header.binaryFormat, cache.data() + sizeof(header), header.binaryLength);
+	GLint Result = GL_FALSE;
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	if (Result != GL_TRUE){
+		glDeleteProgram(ProgramID);
 		return 0;
 	}
+	return ProgramID;
+}
+
+// asks the driver to keep the binary of a program about to be linked
+static void keepProgramBinary(GLuint ProgramID){
+	if (programBinariesSupported()) glProgramParameteri(ProgramID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+}
+
+// best effort, a read only directory just means linking every launch
+static void writeProgramBinary(GLuint ProgramID, uint64_t sourceHash){
+	if (!programBinariesSupported()) return;
+	GLint length = 0;
+	glGetProgramiv(ProgramID, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (length <= 0) return;
+
+	ProgramCacheHeader header;
+	memcpy(header.magic, ProgramCacheMagic, 4);
+	header.version = ProgramCacheVersion;
+	header.sourceHash = sourceHash;
+	header.driverHash = driverHash();
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	glGetProgramBinary(ProgramID, length, &length, &format, binary.data());
+	header.binaryFormat = format;
+	header.binaryLength = (uint32_t)length;
+
+#ifdef _WIN32
+	_mkdir(ShaderCacheDirectory);
+#else
+	mkdir(ShaderCacheDirectory, 0755);
+#endif
+	// written aside and renamed over, so a crash never leaves half a file
+	std::string path = programCachePath(sourceHash);
+	std::string tempPath = path + ".tmp";
+	FILE * file = fopen(tempPath.c_str(), "wb");
+	if (file == NULL) return;
+	bool written =
+		fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(binary.data(), 1, length, file) == (size_t)length;
+	written = fclose(file) == 0 && written;
+	if (written) {
+		remove(path.c_str());
+		written = rename(tempPath.c_str(), path.c_str()) == 0;
+	}
+	if (!written) remove(tempPath.c_str());
+}
 
+bool ReadShaderProgram(const char * vertex_file_path, const char * fragment_file_path, ShaderProgramSource & source){
+	source.vertexPath = vertex_file_path;
+	source.fragmentPath = fragment_file_path;
+	source.cachedBinary.clear();
+
+	// Read the Vertex Shader code from the file
+	if (!readFile(vertex_file_path, source.vertexCode)){
+		printf("Impossible to open %s. Are you in the right directory ? Don't forget to read the FAQ !\n", vertex_file_path);
+		return false;
+	}
 	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if(FragmentShaderStream.is_open()){
-		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
+	if (!readFile(fragment_file_path, source.fragmentCode)){
+		printf("Impossible to open %s. Are you in the right directory ?\n", fragment_file_path);
+		return false;
+	}
+
+	// the terminating zeros keep "ab"+"c" apart from "a"+"bc"
+	source.hash = hashBytes(source.vertexCode.c_str(), source.vertexCode.size() + 1);
+	source.hash = hashBytes(source.fragmentCode.c_str(), source.fragmentCode.size() + 1, source.hash);
+
+	std::string cache;
+	if (readFile(programCachePath(source.hash).c_str(), cache)) source.cachedBinary.assign(cache.begin(), cache.end());
+	return true;
+}
+
+GLuint LoadShaders(const ShaderProgramSource & source){
+	if (source.vertexCode.empty()) return 0;
+
+	GLuint CachedProgramID = loadProgramBinary(source.cachedBinary, source.hash);
+	if (CachedProgramID != 0){
+		printf("Loaded program binary : %s %s\n", source.vertexPath.c_str(), source.fragmentPath.c_str());
+		return CachedProgramID;
 	}
 
+	// Create the shaders
+	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
+	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
+
 	GLint Result = GL_FALSE;
 	int InfoLogLength;
 
 
 	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const * VertexSourcePointer = VertexShaderCode.c_str();
+	printf("Compiling shader : %s\n", source.vertexPath.c_str());
+	char const * VertexSourcePointer = source.vertexCode.c_str();
 	glShaderSource(VertexShaderID, 1, &VertexSourcePointer , NULL);
 	glCompileShader(VertexShaderID);
 
@@ -66,8 +204,8 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 
 
 	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const * FragmentSourcePointer = FragmentShaderCode.c_str();
+	printf("Compiling shader : %s\n", source.fragmentPath.c_str());
+	char const * FragmentSourcePointer = source.fragmentCode.c_str();
 	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer , NULL);
 	glCompileShader(FragmentShaderID);
 
@@ -87,6 +225,7 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	GLuint ProgramID = glCreateProgram();
 	glAttachShader(ProgramID, VertexShaderID);
 	glAttachShader(ProgramID, FragmentShaderID);
+	keepProgramBinary(ProgramID);
 	glLinkProgram(ProgramID);
 
 	// Check the program
@@ -97,6 +236,7 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
 		printf("%s\n", &ProgramErrorMessage[0]);
 	}
+	if (Result == GL_TRUE) writeProgramBinary(ProgramID, source.hash);
 
 	
 	glDetachShader(ProgramID, VertexShaderID);
@@ -108,4 +248,88 @@ GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path
 	return ProgramID;
 }
 
+GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path){
+	ShaderProgramSource source;
+	if (!ReadShaderProgram(vertex_file_path, fragment_file_path, source)){
+		getchar();
+		return 0;
+	}
+	return LoadShaders(source);
+}
+
+GLuint LoadComputeShader(const char * compute_file_path, const char * defines){
+
+	// Read the Compute Shader code from the file
+	std::string ComputeShaderCode;
+	std::ifstream ComputeShaderStream(compute_file_path, std::ios::in);
+	if(ComputeShaderStream.is_open()){
+		std::stringstream sstr;
+		sstr << ComputeShaderStream.rdbuf();
+		ComputeShaderCode = sstr.str();
+		ComputeShaderStream.close();
+	}else{
+		printf("Impossible to open %s. Are you in the right directory ?\n", compute_file_path);
+		return 0;
+	}
+
+	// defines have to come after the #version line
+	size_t VersionEnd = ComputeShaderCode.find('\n');
+	if (defines != NULL && VersionEnd != std::string::npos) {
+		ComputeShaderCode.insert(VersionEnd + 1, std::string(defines) + "\n");
+	}
+
+	// a single stage, no separator needed
+	uint64_t SourceHash = hashBytes(ComputeShaderCode.c_str(), ComputeShaderCode.size() + 1);
+	std::string Cache;
+	if (readFile(programCachePath(SourceHash).c_str(), Cache)){
+		GLuint CachedProgramID = loadProgramBinary(std::vector<char>(Cache.begin(), Cache.end()), SourceHash);
+		if (CachedProgramID != 0){
+			printf("Loaded program binary : %s %s\n", compute_file_path, defines != NULL ? defines : "");
+			return CachedProgramID;
+		}
+	}
+
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
+
+	// Compile Compute Shader
+	printf("Compiling shader : %s %s\n", compute_file_path, defines != NULL ? defines : "");
+	GLuint ComputeShaderID = glCreateShader(GL_COMPUTE_SHADER);
+	char const * ComputeSourcePointer = ComputeShaderCode.c_str();
+	glShaderSource(ComputeShaderID, 1, &ComputeSourcePointer , NULL);
+	glCompileShader(ComputeShaderID);
+
+	// Check Compute Shader
+	glGetShaderiv(ComputeShaderID, GL_COMPILE_STATUS, &Result);
+	glGetShaderiv(ComputeShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if ( InfoLogLength > 0 ){
+		std::vector<char> ComputeShaderErrorMessage(InfoLogLength+1);
+		glGetShaderInfoLog(ComputeShaderID, InfoLogLength, NULL, &ComputeShaderErrorMessage[0]);
+		printf("%s\n", &ComputeShaderErrorMessage[0]);
+	}
+
+	// Link the program
+	GLuint ProgramID = glCreateProgram();
+	glAttachShader(ProgramID, ComputeShaderID);
+	keepProgramBinary(ProgramID);
+	glLinkProgram(ProgramID);
+
+	// Check the program
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if ( InfoLogLength > 0 ){
+		std::vector<char> ProgramErrorMessage(InfoLogLength+1);
+		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+		printf("%s\n", &ProgramErrorMessage[0]);
+	}
+
+	glDetachShader(ProgramID, ComputeShaderID);
+	glDeleteShader(ComputeShaderID);
 
+	if (Result != GL_TRUE) {
+		glDeleteProgram(ProgramID);
+		return 0;
+	}
+	writeProgramBinary(ProgramID, SourceHash);
+	return ProgramID;
+}
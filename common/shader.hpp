@@ -1,6 +1,30 @@
 #ifndef SHADER_HPP
 #define SHADER_HPP
 
+#include <string>
+#include <vector>
+
+// Both stages' sources and the program binary cached for them, read
+// without touching GL so it can happen on a loader thread before the
+// context exists
+struct ShaderProgramSource {
+	std::string vertexPath, fragmentPath;
+	std::string vertexCode, fragmentCode;
+	// of both sources, names the file in shadercache/
+	unsigned long long hash = 0;
+	// the whole cache file, empty when there is none
+	std::vector<char> cachedBinary;
+};
+
+// false if either file can't be read
+bool ReadShaderProgram(const char * vertex_file_path, const char * fragment_file_path, ShaderProgramSource & source);
+// restores the cached binary when it was linked by this driver from the
+// same sources, otherwise compiles, links and rewrites the cache
+GLuint LoadShaders(const ShaderProgramSource & source);
+// ReadShaderProgram then LoadShaders
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
+// defines (e.g. "#define STEP_PASS") go in right after the #version line,
+// returns 0 if the shader does not compile or link. Cached like LoadShaders
+GLuint LoadComputeShader(const char * compute_file_path, const char * defines);
 
 #endif
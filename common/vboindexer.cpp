@@ -1,5 +1,7 @@
 #include <vector>
-#include <map>
+#include <limits>
+#include <cmath>
+#include <cstdint>
 
 #include <glm/glm.hpp>
 
@@ -74,69 +76,143 @@ void indexVBO_slow(
 	}
 }
 
-struct PackedVertex{
-	glm::vec3 position;
-	glm::vec2 uv;
-	glm::vec3 normal;
-	bool operator<(const PackedVertex that) const{
-		return memcmp((void*)this, (void*)&that, sizeof(PackedVertex))>0;
+static const uint32_t EmptySlot = 0xFFFFFFFFu;
+
+// Open addressing table from vertex keys to output indices. Slots hold
+// an output index, the key lives in keys[index], so probing only touches
+// 4 byte slots until the hashes match. Linear probing over a power of two
+// slot count sized up front to stay under half full
+class VertexHashTable{
+public:
+	// one key per vertex attribute float: its bit pattern, or the
+	// attribute rounded to a multiple of epsilon
+	struct Key{
+		uint32_t words[8];
+		bool operator==(const Key & that) const{
+			return memcmp(words, that.words, sizeof(words)) == 0;
+		}
 	};
-};
 
-bool getSimilarVertexIndex_fast( 
-	PackedVertex & packed, 
-	std::map<PackedVertex,unsigned short> & VertexToOutIndex,
-	unsigned short & result
-){
-	std::map<PackedVertex,unsigned short>::iterator it = VertexToOutIndex.find(packed);
-	if ( it == VertexToOutIndex.end() ){
-		return false;
-	}else{
-		result = it->second;
-		return true;
+	VertexHashTable(size_t maxVertices, float epsilon) : inverseEpsilon(epsilon > 0 ? 1.0f / epsilon : 0.0f){
+		size_t nSlots = 16;
+		while (nSlots < 2 * maxVertices) nSlots *= 2;
+		slots.assign(nSlots, EmptySlot);
+		keys.reserve(maxVertices);
+	}
+
+	Key makeKey(const glm::vec3 & vertex, const glm::vec2 & uv, const glm::vec3 & normal) const{
+		float values[8] = { vertex.x, vertex.y, vertex.z, uv.x, uv.y, normal.x, normal.y, normal.z };
+		Key key;
+		for (int i = 0; i < 8; i++){
+			if (inverseEpsilon > 0){
+				int32_t cell = (int32_t)floorf(values[i] * inverseEpsilon + 0.5f);
+				memcpy(&key.words[i], &cell, 4);
+			}else{
+				// adding zero turns -0 into 0
+				float value = values[i] + 0.0f;
+				memcpy(&key.words[i], &value, 4);
+			}
+		}
+		return key;
+	}
+
+	// index of the vertex with this key, or of a new one at the end
+	// (found is then false)
+	uint32_t findOrInsert(const Key & key, bool & found){
+		size_t mask = slots.size() - 1;
+		for (size_t slot = hash(key) & mask; ; slot = (slot + 1) & mask){
+			uint32_t index = slots[slot];
+			if (index == EmptySlot){
+				index = (uint32_t)keys.size();
+				slots[slot] = index;
+				keys.push_back(key);
+				found = false;
+				return index;
+			}
+			if (keys[index] == key){
+				found = true;
+				return index;
+			}
+		}
 	}
-}
 
-void indexVBO(
+private:
+	static size_t hash(const Key & key){
+		// FNV-1a over the words, then a murmur finalizer so the low bits
+		// used for the slot depend on every word
+		uint32_t h = 2166136261u;
+		for (int i = 0; i < 8; i++) h = (h ^ key.words[i]) * 16777619u;
+		h ^= h >> 16; h *= 0x85ebca6bu;
+		h ^= h >> 13; h *= 0xc2b2ae35u;
+		h ^= h >> 16;
+		return h;
+	}
+
+	float inverseEpsilon;
+	std::vector<uint32_t> slots;
+	std::vector<Key> keys;
+};
+
+template <typename Index>
+static bool indexVBO_hashed(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
 
-	std::vector<unsigned short> & out_indices,
+	std::vector<Index> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
-	std::vector<glm::vec3> & out_normals
+	std::vector<glm::vec3> & out_normals,
+	float epsilon
 ){
-	std::map<PackedVertex,unsigned short> VertexToOutIndex;
+	VertexHashTable table(in_vertices.size(), epsilon);
+	out_indices.reserve(out_indices.size() + in_vertices.size());
+	// the table numbers its vertices from 0, the outputs may already hold some
+	size_t first = out_vertices.size();
 
 	// For each input vertex
-	for ( unsigned int i=0; i<in_vertices.size(); i++ ){
-
-		PackedVertex packed = {in_vertices[i], in_uvs[i], in_normals[i]};
-		
-
-		// Try to find a similar vertex in out_XXXX
-		unsigned short index;
-		bool found = getSimilarVertexIndex_fast( packed, VertexToOutIndex, index);
+	for ( size_t i=0; i<in_vertices.size(); i++ ){
+		bool found;
+		size_t index = first + table.findOrInsert(table.makeKey(in_vertices[i], in_uvs[i], in_normals[i]), found);
 
-		if ( found ){ // A similar vertex is already in the VBO, use it instead !
-			out_indices.push_back( index );
-		}else{ // If not, it needs to be added in the output data.
+		if ( !found ){ // a new vertex, it needs to be added in the output data.
+			if ( index > std::numeric_limits<Index>::max() ) return false;
 			out_vertices.push_back( in_vertices[i]);
 			out_uvs     .push_back( in_uvs[i]);
 			out_normals .push_back( in_normals[i]);
-			unsigned short newindex = (unsigned short)out_vertices.size() - 1;
-			out_indices .push_back( newindex );
-			VertexToOutIndex[ packed ] = newindex;
 		}
+		out_indices.push_back( (Index)index );
 	}
+	return true;
 }
 
+bool indexVBO(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
 
+	std::vector<unsigned short> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	float epsilon
+){
+	return indexVBO_hashed(in_vertices, in_uvs, in_normals, out_indices, out_vertices, out_uvs, out_normals, epsilon);
+}
 
+bool indexVBO(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
 
-
-
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	float epsilon
+){
+	return indexVBO_hashed(in_vertices, in_uvs, in_normals, out_indices, out_vertices, out_uvs, out_normals, epsilon);
+}
 
 void indexVBO_TBN(
 	std::vector<glm::vec3> & in_vertices,
@@ -1,7 +1,15 @@
 #ifndef VBOINDEXER_HPP
 #define VBOINDEXER_HPP
 
-void indexVBO(
+// Merges identical vertices (same position, uv and normal) and appends
+// one index per input vertex, in linear time through a hash table. New
+// vertices go after any the outputs already hold and the indices address
+// the whole output arrays.
+// epsilon > 0 merges vertices whose attributes round to the same multiple
+// of epsilon, 0 needs them bit for bit equal. Returns false when the mesh
+// has more distinct vertices than the index type can address, the outputs
+// are then incomplete
+bool indexVBO(
 	std::vector<glm::vec3> & in_vertices,
 	std::vector<glm::vec2> & in_uvs,
 	std::vector<glm::vec3> & in_normals,
@@ -9,7 +17,21 @@ void indexVBO(
 	std::vector<unsigned short> & out_indices,
 	std::vector<glm::vec3> & out_vertices,
 	std::vector<glm::vec2> & out_uvs,
-	std::vector<glm::vec3> & out_normals
+	std::vector<glm::vec3> & out_normals,
+	float epsilon = 0.0f
+);
+
+// same with 32 bit indices, for meshes over 65536 vertices
+bool indexVBO(
+	std::vector<glm::vec3> & in_vertices,
+	std::vector<glm::vec2> & in_uvs,
+	std::vector<glm::vec3> & in_normals,
+
+	std::vector<unsigned int> & out_indices,
+	std::vector<glm::vec3> & out_vertices,
+	std::vector<glm::vec2> & out_uvs,
+	std::vector<glm::vec3> & out_normals,
+	float epsilon = 0.0f
 );
 
 
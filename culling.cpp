@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "culling.hpp"
+
+// keeps the cell table small however far the flock spreads
+static const int MaxCellsPerAxis = 32;
+// boids handed to a thread at a time, each chunk keeps its own totals
+static const int CullChunk = 16384;
+
+static glm::vec3 boidPosition(const BoidInstance& instance) { return instance.position; }
+static glm::vec3 boidPosition(const glm::mat4& model) { return glm::vec3(model[3]); }
+
+Frustum::Frustum(const glm::mat4& viewProjection) {
+	// Gribb and Hartmann: each plane is the last row plus or minus another
+	glm::vec4 rows[4];
+	for (int r = 0; r < 4; r++) {
+		rows[r] = glm::vec4(viewProjection[0][r], viewProjection[1][r], viewProjection[2][r], viewProjection[3][r]);
+	}
+	for (int axis = 0; axis < 3; axis++) {
+		planes[2 * axis] = rows[3] + rows[axis];
+		planes[2 * axis + 1] = rows[3] - rows[axis];
+	}
+}
+
+bool Frustum::intersects(glm::vec3 boxMin, glm::vec3 boxMax) const {
+	for (int p = 0; p < 6; p++) {
+		// the corner furthest along the plane normal
+		glm::vec3 corner(
+			planes[p].x >= 0 ? boxMax.x : boxMin.x,
+			planes[p].y >= 0 ? boxMax.y : boxMin.y,
+			planes[p].z >= 0 ? boxMax.z : boxMin.z
+		);
+		if (glm::dot(glm::vec3(planes[p]), corner) + planes[p].w < 0) return false;
+	}
+	return true;
+}
+
+FlockCuller::FlockCuller(int nThreads) : pool(new ThreadPool(nThreads)) {
+}
+
+int FlockCuller::cull(const BoidInstance* instances, const glm::vec3* colors, int count,
+	const glm::mat4& view, const glm::mat4& projection, float viewportHeight,
+	BoidInstance* outInstances, glm::vec3* outColors) {
+	return cullTransforms(instances, colors, count, view, projection, viewportHeight, outInstances, outColors);
+}
+
+int FlockCuller::cull(const glm::mat4* modelMatrices, const glm::vec3* colors, int count,
+	const glm::mat4& view, const glm::mat4& projection, float viewportHeight,
+	glm::mat4* outMatrices, glm::vec3* outColors) {
+	return cullTransforms(modelMatrices, colors, count, view, projection, viewportHeight, outMatrices, outColors);
+}
+
+template <typename Transform>
+int FlockCuller::cullTransforms(const Transform* transforms, const glm::vec3* colors, int count,
+	const glm::mat4& view, const glm::mat4& projection, float viewportHeight,
+	Transform* outTransforms, glm::vec3* outColors) {
+	for (int t = 0; t < LOD_TIERS; t++) tierFirst[t] = tierCount[t] = 0;
+	nVisibleCells = 0;
+	if (count <= 0) return 0;
+	int nChunks = (count + CullChunk - 1) / CullChunk;
+
+	// bounding box of the flock. glm::min keeps its first argument when
+	// the second is NaN, so diverged boids never widen it
+	chunkMin.resize(nChunks);
+	chunkMax.resize(nChunks);
+	pool->parallelFor(nChunks, 1, [&](int begin, int end) {
+		for (int chunk = begin; chunk < end; chunk++) {
+			glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+			int last = std::min(count, (chunk + 1) * CullChunk);
+			for (int i = chunk * CullChunk; i < last; i++) {
+				glm::vec3 pos = boidPosition(transforms[i]);
+				lo = glm::min(lo, pos);
+				hi = glm::max(hi, pos);
+			}
+			chunkMin[chunk] = lo;
+			chunkMax[chunk] = hi;
+		}
+	});
+	glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+	for (int chunk = 0; chunk < nChunks; chunk++) {
+		boundsMin = glm::min(boundsMin, chunkMin[chunk]);
+		boundsMax = glm::max(boundsMax, chunkMax[chunk]);
+	}
+	if (!(boundsMin.x <= boundsMax.x && boundsMin.y <= boundsMax.y && boundsMin.z <= boundsMax.z)) return 0;
+
+	glm::vec3 extent = boundsMax - boundsMin;
+	float cellSize = std::max(settings.cellSize, std::max(extent.x, std::max(extent.y, extent.z)) / MaxCellsPerAxis);
+	float inverseCellSize = 1 / cellSize;
+	glm::ivec3 dims = glm::min(glm::ivec3(extent * inverseCellSize) + 1, glm::ivec3(MaxCellsPerAxis));
+	int nCells = dims.x * dims.y * dims.z;
+
+	// one visibility test and LOD decision per cell
+	Frustum frustum(projection * view);
+	glm::mat3 rotation(view);
+	glm::vec3 eye = -glm::transpose(rotation) * glm::vec3(view[3]);
+	// projected length is boidSize * pixelScale / distance
+	float pixelScale = settings.boidSize * projection[1][1] * viewportHeight * 0.5f;
+	cellTiers.resize(nCells);
+	for (int index = 0; index < nCells; index++) {
+		glm::ivec3 c(index % dims.x, (index / dims.x) % dims.y, index / (dims.x * dims.y));
+		// pad by a boid so arrows poking out of their cell are kept
+		glm::vec3 cellMin = boundsMin + glm::vec3(c) * cellSize - settings.boidSize;
+		glm::vec3 cellMax = cellMin + cellSize + 2 * settings.boidSize;
+		if (!frustum.intersects(cellMin, cellMax)) {
+			cellTiers[index] = LOD_TIERS;
+			continue;
+		}
+		nVisibleCells++;
+
+		// the closest point decides, so detail never drops too early
+		float distance = glm::length(glm::clamp(eye, cellMin, cellMax) - eye);
+		float pixels = distance > 0 ? pixelScale / distance : FLT_MAX;
+		cellTiers[index] = (unsigned char)(pixels >= settings.fullPixels ? LOD_FULL : pixels >= settings.simplePixels ? LOD_SIMPLE : LOD_POINT);
+	}
+
+	// tier of every boid, counted per chunk
+	boidTiers.resize(count);
+	chunkTiers.assign(nChunks * LOD_TIERS, 0);
+	pool->parallelFor(nChunks, 1, [&](int begin, int end) {
+		for (int chunk = begin; chunk < end; chunk++) {
+			int tiers[LOD_TIERS + 1] = {};
+			int last = std::min(count, (chunk + 1) * CullChunk);
+			for (int i = chunk * CullChunk; i < last; i++) {
+				glm::vec3 cell = (boidPosition(transforms[i]) - boundsMin) * inverseCellSize;
+				unsigned char tier = LOD_TIERS;
+				// false for NaN too
+				if (cell.x >= 0 && cell.y >= 0 && cell.z >= 0 && cell.x < FLT_MAX && cell.y < FLT_MAX && cell.z < FLT_MAX) {
+					glm::ivec3 c = glm::min(glm::ivec3(cell), dims - 1);
+					tier = cellTiers[(c.z * dims.y + c.y) * dims.x + c.x];
+				}
+				boidTiers[i] = tier;
+				tiers[tier]++;
+			}
+			for (int t = 0; t < LOD_TIERS; t++) chunkTiers[chunk * LOD_TIERS + t] = tiers[t];
+		}
+	});
+
+	// tiers back to back, chunks in order within a tier, so the output
+	// keeps flock order. chunkTiers turns into each chunk's write cursors
+	int visible = 0;
+	for (int t = 0; t < LOD_TIERS; t++) {
+		tierFirst[t] = visible;
+		for (int chunk = 0; chunk < nChunks; chunk++) {
+			int n = chunkTiers[chunk * LOD_TIERS + t];
+			chunkTiers[chunk * LOD_TIERS + t] = visible;
+			visible += n;
+		}
+		tierCount[t] = visible - tierFirst[t];
+	}
+
+	pool->parallelFor(nChunks, 1, [&](int begin, int end) {
+		for (int chunk = begin; chunk < end; chunk++) {
+			int* cursor = &chunkTiers[chunk * LOD_TIERS];
+			int last = std::min(count, (chunk + 1) * CullChunk);
+			for (int i = chunk * CullChunk; i < last; i++) {
+				int tier = boidTiers[i];
+				if (tier == LOD_TIERS) continue;
+				int slot = cursor[tier]++;
+				outTransforms[slot] = transforms[i];
+				outColors[slot] = colors[i];
+			}
+		}
+	});
+	return visible;
+}
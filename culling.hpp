@@ -0,0 +1,76 @@
+#ifndef CULLING_HPP
+#define CULLING_HPP
+
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "boids.hpp"
+#include "threadpool.hpp"
+
+// how much detail a boid gets, decided by its size on screen
+enum LodTier { LOD_FULL, LOD_SIMPLE, LOD_POINT, LOD_TIERS };
+
+struct LodSettings {
+	float cellSize;		// culling granularity in world units
+	float boidSize;		// length of the arrow mesh in world units
+	float fullPixels;	// boids at least this long on screen get the full mesh
+	float simplePixels;	// then the simplified arrow, anything smaller is a point
+};
+
+// the six clip planes of a view projection matrix, normals point inside
+struct Frustum {
+	explicit Frustum(const glm::mat4& viewProjection);
+	// conservative, boxes near a corner may pass while just outside
+	bool intersects(glm::vec3 boxMin, glm::vec3 boxMax) const;
+
+	glm::vec4 planes[6];
+};
+
+// Picks the boids worth drawing each frame. The flock's bounding box is
+// split into a coarse grid, every cell is tested against the frustum once
+// and given one LOD tier from its closest point to the camera, so per
+// boid it is only a cell lookup and a copy. Visible boids come out
+// grouped by tier, tier t starting at first(t), ready to draw with one
+// instanced call per tier.
+class FlockCuller {
+public:
+	// nThreads counts the calling thread too, 0 means one per core
+	explicit FlockCuller(int nThreads = 1);
+
+	LodSettings settings = { 16.0f, 5.0f, 16.0f, 10.0f };
+
+	// writes the visible boids and their colors to the outputs (count
+	// entries each at most), returns how many were written
+	int cull(const BoidInstance* instances, const glm::vec3* colors, int count,
+		const glm::mat4& view, const glm::mat4& projection, float viewportHeight,
+		BoidInstance* outInstances, glm::vec3* outColors);
+	// same for full model matrices
+	int cull(const glm::mat4* modelMatrices, const glm::vec3* colors, int count,
+		const glm::mat4& view, const glm::mat4& projection, float viewportHeight,
+		glm::mat4* outMatrices, glm::vec3* outColors);
+
+	int first(LodTier tier) const { return tierFirst[tier]; }
+	int count(LodTier tier) const { return tierCount[tier]; }
+	int visibleCells() const { return nVisibleCells; }
+
+private:
+	template <typename Transform>
+	int cullTransforms(const Transform* transforms, const glm::vec3* colors, int count,
+		const glm::mat4& view, const glm::mat4& projection, float viewportHeight,
+		Transform* outTransforms, glm::vec3* outColors);
+
+	std::unique_ptr<ThreadPool> pool;
+	// LOD tier per cell, then per boid. LOD_TIERS means culled
+	std::vector<unsigned char> cellTiers;
+	std::vector<unsigned char> boidTiers;
+	// per chunk of boids: bounds, then boids per tier, then write cursors
+	std::vector<glm::vec3> chunkMin, chunkMax;
+	std::vector<int> chunkTiers;
+	int tierFirst[LOD_TIERS] = {};
+	int tierCount[LOD_TIERS] = {};
+	int nVisibleCells = 0;
+};
+
+#endif
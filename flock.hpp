@@ -0,0 +1,77 @@
+#ifndef FLOCK_HPP
+#define FLOCK_HPP
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#ifdef _MSC_VER
+#include <malloc.h>
+#endif
+
+// cache line alignment, also enough for 512 bit vector loads
+const size_t FlockAlignment = 64;
+
+template <typename T>
+struct AlignedAllocator {
+	typedef T value_type;
+
+	AlignedAllocator() {}
+	template <typename U> AlignedAllocator(const AlignedAllocator<U>&) {}
+
+	T* allocate(size_t n) {
+		// round up to whole lines plus one spare line, so vector kernels
+		// may load a full register starting at the last element
+		size_t bytes = (n * sizeof(T) + FlockAlignment - 1) / FlockAlignment * FlockAlignment + FlockAlignment;
+#ifdef _MSC_VER
+		void* p = _aligned_malloc(bytes, FlockAlignment);
+#else
+		void* p = NULL;
+		if (posix_memalign(&p, FlockAlignment, bytes) != 0) p = NULL;
+#endif
+		if (p == NULL) throw std::bad_alloc();
+		return (T*)p;
+	}
+	void deallocate(T* p, size_t) {
+#ifdef _MSC_VER
+		_aligned_free(p);
+#else
+		std::free(p);
+#endif
+	}
+
+	template <typename U> bool operator==(const AlignedAllocator<U>&) const { return true; }
+	template <typename U> bool operator!=(const AlignedAllocator<U>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Structure of arrays storage for the flock. Neighbor scans only stream
+// the position/velocity components they read, colors live apart since
+// they are only needed for drawing.
+struct FlockState {
+	AlignedVector<float> px, py, pz;
+	AlignedVector<float> vx, vy, vz;
+	std::vector<glm::vec3> colors;
+
+	size_t size() const { return px.size(); }
+
+	void resize(size_t n) {
+		px.resize(n); py.resize(n); pz.resize(n);
+		vx.resize(n); vy.resize(n); vz.resize(n);
+		colors.resize(n);
+	}
+	void clear() { resize(0); }
+
+	glm::vec3 position(size_t i) const { return glm::vec3(px[i], py[i], pz[i]); }
+	glm::vec3 velocity(size_t i) const { return glm::vec3(vx[i], vy[i], vz[i]); }
+
+	void setPosition(size_t i, glm::vec3 p) { px[i] = p.x; py[i] = p.y; pz[i] = p.z; }
+	void setVelocity(size_t i, glm::vec3 v) { vx[i] = v.x; vy[i] = v.y; vz[i] = v.z; }
+};
+
+#endif
@@ -0,0 +1,131 @@
+// compares the compute shader step against the CPU step, one step at a time.
+// Works on any GL 4.3 driver, including Mesa's llvmpipe without a GPU
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include <glm/glm.hpp>
+
+#include "flock.hpp"
+#include "boids.hpp"
+#include "gpuflock.hpp"
+
+void printUsage(const char* program) {
+	printf("usage: %s [options]\n", program);
+	printf("  -n <count>         boids in the flock (default 10000)\n");
+	printf("  -steps <count>     steps to compare (default 50)\n");
+	printf("  -seed <value>      random seed (default 1)\n");
+	printf("  -tolerance <value> largest position or velocity difference that passes (default 1e-3)\n");
+}
+
+bool isFinite(glm::vec3 v) {
+	return std::isfinite(v.x) && std::isfinite(v.y) && std::isfinite(v.z);
+}
+
+int main(int argc, char* argv[]) {
+	int nBoids = 10000;
+	int nSteps = 50;
+	float tolerance = 1e-3f;
+	setSeed(1);
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : "";
+		if (strcmp(arg, "-h") == 0 || strcmp(arg, "-help") == 0) { printUsage(argv[0]); return 0; }
+
+		if (strcmp(arg, "-n") == 0) nBoids = atoi(value);
+		else if (strcmp(arg, "-steps") == 0) nSteps = atoi(value);
+		else if (strcmp(arg, "-seed") == 0) setSeed(strtoull(value, NULL, 0));
+		else if (strcmp(arg, "-tolerance") == 0) tolerance = (float)atof(value);
+		else {
+			fprintf(stderr, "Unknown option %s\n", arg);
+			printUsage(argv[0]);
+			return -1;
+		}
+		i++;
+	}
+	if (nBoids <= 0 || nSteps <= 0) {
+		fprintf(stderr, "Need at least one boid and one step\n");
+		return -1;
+	}
+
+	// hidden window, only for the GL 4.3 context
+	if (!glfwInit()) {
+		fprintf(stderr, "Failed to initialize GLFW\n");
+		return -1;
+	}
+	glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+	GLFWwindow* window = glfwCreateWindow(64, 64, "Boids GPU check", NULL, NULL);
+	if (window == NULL) {
+		fprintf(stderr, "Failed to create a GL 4.3 context\n");
+		glfwTerminate();
+		return -1;
+	}
+	glfwMakeContextCurrent(window);
+	glewExperimental = true;
+	if (glewInit() != GLEW_OK || !GpuFlock::supported()) {
+		fprintf(stderr, "GL 4.3 compute shaders not available\n");
+		glfwTerminate();
+		return -1;
+	}
+	printf("%s, %s\n", (const char*)glGetString(GL_RENDERER), (const char*)glGetString(GL_VERSION));
+
+	// the compute step matches the grid based double buffered CPU step
+	setNeighborSearch(SPATIAL_GRID);
+	setIntegrationMode(DOUBLE_BUFFERED);
+	createBoids(nBoids);
+
+	GpuFlock gpu;
+	if (!gpu.create(getFlockState(), getStepCount())) {
+		fprintf(stderr, "Failed to build the compute shaders\n");
+		glfwTerminate();
+		return -1;
+	}
+
+	// restart the GPU from the CPU state every step, so differences
+	// show one step of error rather than the flock's chaos amplifying them
+	FlockState fromGpu;
+	float worstPosition = 0, worstVelocity = 0;
+	long long over = 0, colorMismatches = 0, nonFinite = 0;
+	for (int step = 0; step < nSteps; step++) {
+		gpu.upload(getFlockState(), getStepCount());
+		gpu.step();
+		computeBoidModelMatrices();
+		gpu.download(fromGpu);
+
+		const FlockState& cpu = getFlockState();
+		for (int i = 0; i < nBoids; i++) {
+			// NaN or Inf on either side is a broken step, even if both agree
+			bool finite = isFinite(cpu.position(i)) && isFinite(cpu.velocity(i)) &&
+				isFinite(fromGpu.position(i)) && isFinite(fromGpu.velocity(i));
+			if (!finite) nonFinite++;
+			float dp = glm::length(cpu.position(i) - fromGpu.position(i));
+			float dv = glm::length(cpu.velocity(i) - fromGpu.velocity(i));
+			worstPosition = std::max(worstPosition, dp);
+			worstVelocity = std::max(worstVelocity, dv);
+			if (!finite || !(dp <= tolerance && dv <= tolerance)) over++;
+			if (glm::length(cpu.colors[i] - fromGpu.colors[i]) > 1e-3f) colorMismatches++;
+		}
+	}
+
+	gpu.destroy();
+	glfwTerminate();
+
+	long long total = (long long)nBoids * nSteps;
+	printf("%d boids, %d steps: max position diff %g, max velocity diff %g\n", nBoids, nSteps, worstPosition, worstVelocity);
+	printf("%lld of %lld boid steps over %g, %lld not finite, %lld color mismatches\n", over, total, tolerance, nonFinite, colorMismatches);
+	// a neighbor sitting right on the radius can flip in or out between
+	// the two, so allow a handful of outliers
+	bool pass = nonFinite == 0 && over * 1000 <= total;
+	printf("%s\n", pass ? "PASS" : "FAIL");
+	return pass ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "gpuflock.hpp"
+#include <common/shader.hpp>
+#include "flock.hpp"
+#include "boids.hpp"
+
+// must match BoidsCompute.computeshader
+static const int GroupSize = 256;
+static const int ScanBlock = 1024;
+
+static void setUniform(GLuint program, const char* name, unsigned int value) {
+	glUniform1ui(glGetUniformLocation(program, name), value);
+}
+static void setUniform(GLuint program, const char* name, float value) {
+	glUniform1f(glGetUniformLocation(program, name), value);
+}
+static void setUniform(GLuint program, const char* name, uint64_t value) {
+	glUniform2ui(glGetUniformLocation(program, name), (unsigned int)value, (unsigned int)(value >> 32));
+}
+
+bool GpuFlock::supported() {
+	return GLEW_VERSION_4_3 != 0;
+}
+
+bool GpuFlock::create(const FlockState& flock, uint64_t step) {
+	destroy();
+	if (!supported()) return false;
+
+	const char* path = "BoidsCompute.computeshader";
+	binProgram = LoadComputeShader(path, "#define BIN_PASS");
+	scanProgram = LoadComputeShader(path, "#define SCAN_PASS");
+	scanSumsProgram = LoadComputeShader(path, "#define SCAN_SUMS_PASS");
+	scanAddProgram = LoadComputeShader(path, "#define SCAN_ADD_PASS");
+	scatterProgram = LoadComputeShader(path, "#define SCATTER_PASS");
+	stepProgram = LoadComputeShader(path, "#define STEP_PASS");
+	if (!binProgram || !scanProgram || !scanSumsProgram || !scanAddProgram || !scatterProgram || !stepProgram) {
+		destroy();
+		return false;
+	}
+
+	allocate((int)flock.size());
+	upload(flock, step);
+	return true;
+}
+
+void GpuFlock::destroy() {
+	GLuint programs[] = { binProgram, scanProgram, scanSumsProgram, scanAddProgram, scatterProgram, stepProgram };
+	for (int p = 0; p < 6; p++) {
+		if (programs[p]) glDeleteProgram(programs[p]);
+	}
+	binProgram = scanProgram = scanSumsProgram = scanAddProgram = scatterProgram = stepProgram = 0;
+
+	if (colors) {
+		glDeleteBuffers(2, positions);
+		glDeleteBuffers(2, velocities);
+		glDeleteBuffers(1, &colors);
+		glDeleteBuffers(1, &cells);
+		glDeleteBuffers(1, &blockSums);
+		glDeleteBuffers(1, &pointSlots);
+		glDeleteBuffers(1, &sortedIndices);
+	}
+	positions[0] = positions[1] = velocities[0] = velocities[1] = 0;
+	colors = cells = blockSums = pointSlots = sortedIndices = 0;
+	count = 0;
+}
+
+void GpuFlock::allocate(int newCount) {
+	count = newCount;
+	// same sizing as SpatialGrid, at least twice the boid count
+	tableSize = 64;
+	while (tableSize < 2u * (unsigned int)count) tableSize <<= 1;
+	int blockCount = (int)(tableSize + 1 + ScanBlock - 1) / ScanBlock;
+
+	GLuint* buffers[] = { &positions[0], &positions[1], &velocities[0], &velocities[1], &colors, &cells, &blockSums, &pointSlots, &sortedIndices };
+	size_t sizes[] = {
+		count * sizeof(glm::vec4), count * sizeof(glm::vec4), count * sizeof(glm::vec4), count * sizeof(glm::vec4), count * sizeof(glm::vec4),
+		(tableSize + 1) * sizeof(GLuint), blockCount * sizeof(GLuint), count * 2 * sizeof(GLuint), count * sizeof(GLuint)
+	};
+	for (int b = 0; b < 9; b++) {
+		glGenBuffers(1, buffers[b]);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, *buffers[b]);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, sizes[b], NULL, GL_DYNAMIC_COPY);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void GpuFlock::upload(const FlockState& flock, uint64_t step) {
+	std::vector<glm::vec4> position(count), velocity(count), color(count);
+	for (int i = 0; i < count; i++) {
+		position[i] = glm::vec4(flock.position(i), 1);
+		velocity[i] = glm::vec4(flock.velocity(i), 0);
+		color[i] = glm::vec4(flock.colors[i], 1);
+	}
+	front = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, positions[front]);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(glm::vec4), position.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, velocities[front]);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(glm::vec4), velocity.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, colors);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(glm::vec4), color.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	steps = step;
+}
+
+void GpuFlock::download(FlockState& flock) {
+	std::vector<glm::vec4> position(count), velocity(count), color(count);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, positions[front]);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(glm::vec4), position.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, velocities[front]);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(glm::vec4), velocity.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, colors);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, count * sizeof(glm::vec4), color.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	flock.resize(count);
+	for (int i = 0; i < count; i++) {
+		flock.setPosition(i, glm::vec3(position[i]));
+		flock.setVelocity(i, glm::vec3(velocity[i]));
+		flock.colors[i] = glm::vec3(color[i]);
+	}
+}
+
+void GpuFlock::dispatch(int invocations) {
+	glDispatchCompute((invocations + GroupSize - 1) / GroupSize, 1, 1);
+	// every pass reads what the one before it wrote
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void GpuFlock::step() {
+	if (count == 0) return;
+	BoidParams params = getBoidParams();
+	unsigned int cellCount = tableSize + 1;
+	unsigned int blockCount = (cellCount + ScanBlock - 1) / ScanBlock;
+
+	GLuint bindings[] = { positions[front], velocities[front], positions[1 - front], velocities[1 - front], colors, cells, blockSums, pointSlots, sortedIndices };
+	for (int b = 0; b < 9; b++) {
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, b, bindings[b]);
+	}
+
+	// bin: count boids per slot, then turn the counts into start offsets
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, cells);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, NULL);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glUseProgram(binProgram);
+	setUniform(binProgram, "count", (unsigned int)count);
+	setUniform(binProgram, "tableMask", tableSize - 1);
+	setUniform(binProgram, "inverseCellSize", 1 / params.radius);
+	dispatch(count);
+
+	glUseProgram(scanProgram);
+	setUniform(scanProgram, "cellCount", cellCount);
+	glDispatchCompute(blockCount, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(scanSumsProgram);
+	setUniform(scanSumsProgram, "blockCount", blockCount);
+	glDispatchCompute(1, 1, 1);
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+	glUseProgram(scanAddProgram);
+	setUniform(scanAddProgram, "cellCount", cellCount);
+	dispatch((int)cellCount);
+
+	glUseProgram(scatterProgram);
+	setUniform(scatterProgram, "count", (unsigned int)count);
+	dispatch(count);
+
+	// the step itself, front to back
+	glUseProgram(stepProgram);
+	setUniform(stepProgram, "count", (unsigned int)count);
+	setUniform(stepProgram, "tableMask", tableSize - 1);
+	setUniform(stepProgram, "inverseCellSize", 1 / params.radius);
+	setUniform(stepProgram, "radius2", params.radius * params.radius);
+	setUniform(stepProgram, "inverseR02", 1 / (params.r0 * params.r0));
+	setUniform(stepProgram, "A", params.A);
+	setUniform(stepProgram, "cohesion", params.cohesion);
+	setUniform(stepProgram, "noiseScale", params.noise);
+	setUniform(stepProgram, "gravity", params.gravity);
+	setUniform(stepProgram, "dt", params.dt);
+	setUniform(stepProgram, "colorScale", count / params.colorChange);
+	setUniform(stepProgram, "seed", getSeed());
+	setUniform(stepProgram, "stepIndex", steps);
+	glDispatchCompute((count + GroupSize - 1) / GroupSize, 1, 1);
+	// the draw reads the new state as vertex attributes
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	front = 1 - front;
+	steps++;
+}
+
+void GpuFlock::bindInstanceAttributes() {
+	GLuint sources[] = { colors, positions[front], velocities[front] };
+	for (int a = 0; a < 3; a++) {
+		glBindBuffer(GL_ARRAY_BUFFER, sources[a]);
+		glVertexAttribPointer(3 + a, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (void*)0);
+		glVertexAttribDivisor(3 + a, 1);
+		glEnableVertexAttribArray(3 + a);
+	}
+}
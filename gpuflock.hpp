@@ -0,0 +1,67 @@
+#ifndef GPUFLOCK_HPP
+#define GPUFLOCK_HPP
+
+#include <cstdint>
+
+#include <GL/glew.h>
+
+struct FlockState;
+
+// Double buffered step run as GL 4.3 compute shaders over shader storage
+// buffers (BoidsCompute.computeshader). Every step rebuilds the hashed
+// grid on the GPU with a count, prefix sum and scatter, then runs the
+// same three laws, noise and center pull as the CPU step. The position,
+// velocity and color buffers double as instance attributes for
+// BoidsCompactVertexShader, so nothing is read back to draw a frame.
+class GpuFlock {
+public:
+	~GpuFlock() { destroy(); }
+
+	// needs a GL 4.3 context
+	static bool supported();
+	// compiles the passes and uploads flock, false if anything failed
+	bool create(const FlockState& flock, uint64_t step);
+	void destroy();
+
+	// replaces the state on the GPU, flock must keep the same size
+	void upload(const FlockState& flock, uint64_t step);
+	// reads the state back, only needed to compare against the CPU
+	void download(FlockState& flock);
+
+	// one step with the current getBoidParams and getSeed
+	void step();
+
+	// points instance attributes 3 (color), 4 (position) and 5 (heading)
+	// of the bound VAO at the current state
+	void bindInstanceAttributes();
+
+	int size() const { return count; }
+	uint64_t stepCount() const { return steps; }
+
+private:
+	void allocate(int newCount);
+	void dispatch(int invocations);
+
+	int count = 0;
+	uint64_t steps = 0;
+	unsigned int tableSize = 0;
+	int front = 0;
+
+	GLuint binProgram = 0;
+	GLuint scanProgram = 0;
+	GLuint scanSumsProgram = 0;
+	GLuint scanAddProgram = 0;
+	GLuint scatterProgram = 0;
+	GLuint stepProgram = 0;
+
+	// vec4 per boid, two copies for double buffering
+	GLuint positions[2] = {};
+	GLuint velocities[2] = {};
+	GLuint colors = 0;
+	GLuint cells = 0;
+	GLuint blockSums = 0;
+	GLuint pointSlots = 0;
+	GLuint sortedIndices = 0;
+};
+
+#endif
@@ -1,4 +1,9 @@
 // based on opengl-tutorial https://www.opengl-tutorial.org/
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <thread>
 #include <vector>
 
 // GLEW - OpenGL extensions
@@ -18,33 +23,231 @@ using namespace glm;
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/meshcache.hpp>
 #include "boids.hpp"
+#include "culling.hpp"
+#include "gpuflock.hpp"
+#include "profiler.hpp"
+#include "simthread.hpp"
+#include "threadpool.hpp"
+#include "trace.hpp"
+#include "uploadring.hpp"
+
+// INSTANCE_COMPACT sends position and heading (24 bytes a boid) and
+// rotates in the vertex shader, INSTANCE_MATRICES sends full matrices
+InstanceFormat instanceFormat = INSTANCE_COMPACT;
+// step the flock with compute shaders instead of on the CPU, needs GL 4.3
+// and always draws compact instances. Falls back to the CPU without it
+bool gpuSimulation = false;
+// skip boids outside the view and draw distant ones with less detail.
+// Needs the flock on the CPU, so the GPU backend always draws everything
+bool cullFlock = true;
+// step stepRate times per second of real time whatever the frame rate and
+// draw the flock in between its last two steps. false steps once a frame
+bool fixedTimestep = true;
+double stepRate = 60;
+// steps the simulation may owe before the clock is held back, so a flock
+// too heavy for stepRate slows down instead of falling ever further behind
+int maxCatchUpSteps = 4;
+// per phase frame times and their percentiles, written on exit to
+// profilePath plus .csv and .json. NULL only prints the per second line
+const char* profilePath = "frame_profile";
+
+// one indexed mesh in its own VAO, per instance attributes are bound per draw
+struct Mesh {
+	GLuint vertexArray;
+	GLuint elementbuffer;
+	GLuint vertexbuffer;
+	GLsizei indexCount;
+	GLenum indexType;
+};
+
+Mesh createMesh(const MeshData& data) {
+	Mesh mesh;
+	mesh.indexCount = (GLsizei)data.indexCount;
+	mesh.indexType = data.indexSize == 4 ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+	glGenVertexArrays(1, &mesh.vertexArray);
+	glBindVertexArray(mesh.vertexArray);
+
+	// Load data into buffers, straight from the mesh cache mapping
+	glGenBuffers(1, &mesh.elementbuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.elementbuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.indexCount * data.indexSize, data.indices, GL_STATIC_DRAW);
+
+	// positions and normals interleaved in one buffer
+	glGenBuffers(1, &mesh.vertexbuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, mesh.vertexbuffer);
+	glBufferData(GL_ARRAY_BUFFER, data.vertexCount * sizeof(MeshVertex), data.vertices, GL_STATIC_DRAW);
+	glVertexAttribPointer(
+		0,                  // attribute
+		3,                  // size
+		GL_FLOAT,           // type
+		GL_FALSE,           // normalized?
+		sizeof(MeshVertex), // stride
+		(void*)offsetof(MeshVertex, position) // array buffer offset
+	);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, normal));
+	glEnableVertexAttribArray(2);
 
-void computeMatrices() {
-	computeMatricesFromInputs();
-	computeBoidModelMatrices();
+	glBindVertexArray(0);
+	return mesh;
 }
 
+void deleteMesh(const Mesh& mesh) {
+	glDeleteBuffers(1, &mesh.elementbuffer);
+	glDeleteBuffers(1, &mesh.vertexbuffer);
+	glDeleteVertexArrays(1, &mesh.vertexArray);
+}
+
+// 10 triangle stand-in for arrow.obj (28) with the same bounds: a four
+// sided head over the top 40% and a spike for the shaft
+void simplifiedArrow(glm::vec3 boundsMin, glm::vec3 boundsMax, std::vector<glm::vec3>& vertices, std::vector<glm::vec2>& uvs, std::vector<glm::vec3>& normals) {
+	glm::vec3 center = (boundsMin + boundsMax) * 0.5f;
+	glm::vec3 half = (boundsMax - boundsMin) * 0.5f;
+	float headBase = boundsMax.y - 0.4f * (boundsMax.y - boundsMin.y);
+	float shaft = 0.4f;
+	glm::vec3 tip(center.x, boundsMax.y, center.z);
+	glm::vec3 tail(center.x, boundsMin.y, center.z);
+	// head corners and the top of the shaft, going around the y axis
+	glm::vec3 head[4], shaftTop[4];
+	glm::vec2 corners[4] = { glm::vec2(1, 1), glm::vec2(1, -1), glm::vec2(-1, -1), glm::vec2(-1, 1) };
+	for (int k = 0; k < 4; k++) {
+		head[k] = glm::vec3(center.x + corners[k].x * half.x, headBase, center.z + corners[k].y * half.z);
+		shaftTop[k] = glm::vec3(center.x + corners[k].x * half.x * shaft, headBase, center.z + corners[k].y * half.z * shaft);
+	}
+
+	// each triangle with a direction its normal has to face
+	vertices.clear();
+	std::vector<glm::vec3> outward;
+	for (int k = 0; k < 4; k++) {
+		int next = (k + 1) % 4;
+		glm::vec3 side = glm::vec3(corners[k].x + corners[next].x, 0, corners[k].y + corners[next].y);
+		glm::vec3 triangles[6] = { tip, head[k], head[next], tail, shaftTop[k], shaftTop[next] };
+		vertices.insert(vertices.end(), triangles, triangles + 6);
+		outward.push_back(side);
+		outward.push_back(side);
+	}
+	glm::vec3 underside[6] = { head[0], head[1], head[2], head[0], head[2], head[3] };
+	vertices.insert(vertices.end(), underside, underside + 6);
+	outward.push_back(glm::vec3(0, -1, 0));
+	outward.push_back(glm::vec3(0, -1, 0));
+
+	// flat shaded, wound counter clockwise seen from outside
+	normals.resize(vertices.size());
+	for (size_t v = 0; v < vertices.size(); v += 3) {
+		glm::vec3 n = glm::normalize(glm::cross(vertices[v + 1] - vertices[v], vertices[v + 2] - vertices[v]));
+		if (glm::dot(n, outward[v / 3]) < 0) {
+			std::swap(vertices[v + 1], vertices[v + 2]);
+			n = -n;
+		}
+		normals[v] = normals[v + 1] = normals[v + 2] = n;
+	}
+	uvs.assign(vertices.size(), glm::vec2(0));
+}
+
+// points the per instance attributes of the bound VAO into buffer.
+// divisor 1 steps them once per boid instead of once per vertex
+void bindInstanceAttributes(GLuint buffer, size_t transformOffset, size_t colorOffset) {
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, (void*)colorOffset);
+	glVertexAttribDivisor(3, 1);
+	glEnableVertexAttribArray(3);
+	if (instanceFormat == INSTANCE_COMPACT) {
+		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(BoidInstance), (void*)(transformOffset + offsetof(BoidInstance, position)));
+		glVertexAttribPointer(5, 3, GL_FLOAT, GL_FALSE, sizeof(BoidInstance), (void*)(transformOffset + offsetof(BoidInstance, heading)));
+		for (int location = 4; location <= 5; location++) {
+			glVertexAttribDivisor(location, 1);
+			glEnableVertexAttribArray(location);
+		}
+		return;
+	}
+	// a mat4 attribute is four vec4 columns in consecutive locations
+	for (int column = 0; column < 4; column++) {
+		glVertexAttribPointer(4 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(transformOffset + column * sizeof(glm::vec4)));
+		glVertexAttribDivisor(4 + column, 1);
+		glEnableVertexAttribArray(4 + column);
+	}
+}
+
+// the point shader only takes color and position, which sits in the
+// last column of a model matrix
+void bindPointAttributes(GLuint buffer, size_t transformOffset, size_t colorOffset) {
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, (void*)colorOffset);
+	if (instanceFormat == INSTANCE_COMPACT) {
+		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(BoidInstance), (void*)(transformOffset + offsetof(BoidInstance, position)));
+	}
+	else {
+		glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (void*)(transformOffset + 3 * sizeof(glm::vec4)));
+	}
+	for (int location = 3; location <= 4; location++) {
+		glVertexAttribDivisor(location, 1);
+		glEnableVertexAttribArray(location);
+	}
+}
 
 int main(void) {
+	// reading shaders and meshes and creating the flock need no GL, so
+	// they run on a loader thread while the window and context come up
+	const char* vertexShader = instanceFormat == INSTANCE_COMPACT ? "BoidsCompactVertexShader.vertexshader" : "BoidsVertexShader.vertexshader";
+	ShaderProgramSource boidShaders, pointShaders;
+	MeshData arrow, simpleArrow;
+	glm::vec3 arrowMin(0), arrowMax(0);
+	int nBoids = 100;
+	// false if a shader or mesh is missing, checked once the loader is done
+	bool assetsLoaded = false;
+	TRACE_THREAD_NAME("render");
+	std::thread loader([&] {
+		TRACE_THREAD_NAME("loader");
+		TRACE_SCOPE("loadAssets");
+		assetsLoaded = ReadShaderProgram(vertexShader, "BoidsFragmentShader.fragmentshader", boidShaders) &&
+			// distant boids are round points with their own shaders
+			ReadShaderProgram("BoidsPointVertexShader.vertexshader", "BoidsPointFragmentShader.fragmentshader", pointShaders) &&
+			// parsed and indexed once, then mapped from arrow.obj.meshcache
+			loadMeshCached("arrow.obj", arrow);
+		if (!assetsLoaded) return;
+		for (size_t v = 0; v < arrow.vertexCount; v++) {
+			arrowMin = v == 0 ? arrow.vertices[v].position : glm::min(arrowMin, arrow.vertices[v].position);
+			arrowMax = v == 0 ? arrow.vertices[v].position : glm::max(arrowMax, arrow.vertices[v].position);
+		}
+		std::vector<glm::vec3> vertices;
+		std::vector<glm::vec2> uvs;
+		std::vector<glm::vec3> normals;
+		simplifiedArrow(arrowMin, arrowMax, vertices, uvs, normals);
+		buildMesh(vertices, uvs, normals, simpleArrow);
+
+		createBoids(nBoids);
+	});
+
 	// Initialise GLFW
 	if (!glfwInit())
 	{
 		fprintf(stderr, "Failed to initialize GLFW\n");
+		loader.join();
 		getchar();
 		return -1;
 	}
 
 	glfwWindowHint(GLFW_SAMPLES, 1);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
 	glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE); // To make MacOS happy; should not be needed
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
 	// Open a window and create its OpenGL context
-	window = glfwCreateWindow(1024, 768, "Boids", NULL, NULL);
+	window = NULL;
+	if (gpuSimulation) {
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		window = glfwCreateWindow(1024, 768, "Boids", NULL, NULL);
+	}
+	if (window == NULL) {
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+		glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+		window = glfwCreateWindow(1024, 768, "Boids", NULL, NULL);
+	}
 	if (window == NULL) {
 		fprintf(stderr, "Failed to open GLFW window. If you have an Intel GPU, they are not 3.3 compatible. Try the 2.1 version of the tutorials.\n");
+		loader.join();
 		getchar();
 		glfwTerminate();
 		return -1;
@@ -55,10 +258,17 @@ int main(void) {
 	glewExperimental = true; // Needed for core profile
 	if (glewInit() != GLEW_OK) {
 		fprintf(stderr, "Failed to initialize GLEW\n");
+		loader.join();
 		getchar();
 		glfwTerminate();
 		return -1;
 	}
+	if (gpuSimulation && !GpuFlock::supported()) {
+		printf("GL 4.3 not available, simulating on the CPU\n");
+		gpuSimulation = false;
+	}
+	// the compute buffers hold positions and velocities, not matrices
+	if (gpuSimulation) instanceFormat = INSTANCE_COMPACT;
 
 	// Ensure we can capture the escape key being pressed below
 	glfwSetInputMode(window, GLFW_STICKY_KEYS, GL_TRUE);
@@ -72,6 +282,8 @@ int main(void) {
 	glEnable(GL_DEPTH_TEST);
 	// draw fragment if depth < previous drawn
 	glDepthFunc(GL_LESS);
+	// far boids size their points in the vertex shader
+	glEnable(GL_PROGRAM_POINT_SIZE);
 	// Cull triangles which normal is not towards the camera
 	glEnable(GL_CULL_FACE); // disable when using transparency
 
@@ -80,145 +292,285 @@ int main(void) {
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glDisable(GL_BLEND); // comment out to leave enabled
 
-	// Create and compile our GLSL program from the shaders
-	GLuint programID = LoadShaders("BoidsVertexShader.vertexshader", "BoidsFragmentShader.fragmentshader");
-
-	// Get a handle for our "MVP" uniform
-	GLuint MatrixID = glGetUniformLocation(programID, "MVP");
-	// handles for view/model uniforms
-	GLuint ViewMatrixID = glGetUniformLocation(programID, "V");
-	GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
-
-	std::vector<glm::vec3> vertices;
-	std::vector<glm::vec2> uvs;
-	std::vector<glm::vec3> normals;
-	bool res = loadOBJ("arrow.obj", vertices, uvs, normals);
-
-	// VBO indexing
-	std::vector<unsigned short> indices;
-	std::vector<glm::vec3> indexed_vertices;
-	std::vector<glm::vec2> indexed_uvs;
-	std::vector<glm::vec3> indexed_normals;
-	indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
+	// everything below needs what the loader read
+	loader.join();
 
-	GLuint VertexArrayID;
-	glGenVertexArrays(1, &VertexArrayID);
-	glBindVertexArray(VertexArrayID);
+	// Create and compile our GLSL program from the shaders, or restore
+	// the binary cached by an earlier run. The GPU backend may have
+	// switched to compact instances since the loader started
+	if (assetsLoaded && instanceFormat == INSTANCE_COMPACT && boidShaders.vertexPath != "BoidsCompactVertexShader.vertexshader") {
+		assetsLoaded = ReadShaderProgram("BoidsCompactVertexShader.vertexshader", "BoidsFragmentShader.fragmentshader", boidShaders);
+	}
+	if (!assetsLoaded) {
+		fprintf(stderr, "Failed to load the shaders and meshes, are you in the right directory?\n");
+		getchar();
+		glfwTerminate();
+		return -1;
+	}
+	GLuint programID = LoadShaders(boidShaders);
 
-	// Load data into buffers
-	GLuint elementbuffer;
-	glGenBuffers(1, &elementbuffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
+	// Get a handle for our "VP" uniform, model matrices come per instance
+	GLuint ViewProjectionMatrixID = glGetUniformLocation(programID, "VP");
+	GLuint ViewMatrixID = glGetUniformLocation(programID, "V");
 
-	GLuint vertexbuffer;
-	glGenBuffers(1, &vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_vertices.size() * sizeof(glm::vec3), &indexed_vertices[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(
-		0,                  // attribute
-		3,                  // size
-		GL_FLOAT,           // type
-		GL_FALSE,           // normalized?
-		0,                  // stride
-		(void*)0            // array buffer offset
-	);
-	glEnableVertexAttribArray(0);
+	GLuint pointProgramID = LoadShaders(pointShaders);
+	GLuint PointViewProjectionMatrixID = glGetUniformLocation(pointProgramID, "VP");
+	GLuint PointViewMatrixID = glGetUniformLocation(pointProgramID, "V");
+	GLuint PointScaleID = glGetUniformLocation(pointProgramID, "PointScale");
 
-	GLuint uvbuffer;
-	glGenBuffers(1, &uvbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_uvs.size() * sizeof(glm::vec2), &indexed_uvs[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-	glEnableVertexAttribArray(1);
-
-	GLuint normalbuffer;
-	glGenBuffers(1, &normalbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_normals.size() * sizeof(glm::vec3), &indexed_normals[0], GL_STATIC_DRAW);
-	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-	glEnableVertexAttribArray(2);
+	// one mesh per LOD tier, points need no mesh
+	Mesh meshes[LOD_POINT];
+	meshes[LOD_FULL] = createMesh(arrow);
+	meshes[LOD_SIMPLE] = createMesh(simpleArrow);
+	GLuint pointVertexArray;
+	glGenVertexArrays(1, &pointVertexArray);
 
-	glBindVertexArray(0);
+	// sorts the flock into LOD tiers on every core each frame
+	FlockCuller culler(0);
+	culler.settings.boidSize = arrowMax.y - arrowMin.y;
 
 	// Get a handle for our "LightPosition" uniform
 	glUseProgram(programID);
 	GLuint LightPosID = glGetUniformLocation(programID, "LightPosition_worldspace");
 	GLuint LightColorID = glGetUniformLocation(programID, "LightColor");
 	GLuint LightPowerID = glGetUniformLocation(programID, "LightPower");
-	GLuint DiffuseColorID = glGetUniformLocation(programID, "DiffuseColor");
 
-	double lastTime = glfwGetTime();
-	int nFrames = 0;
+	// the GPU backend takes over the flock, its buffers feed the draw
+	GpuFlock gpu;
+	if (gpuSimulation && !gpu.create(getFlockState(), getStepCount())) {
+		printf("Compute shaders failed to build, simulating on the CPU\n");
+		gpuSimulation = false;
+	}
 
-	int nBoids = 100;
-	createBoids(nBoids);
+	// per instance transforms followed by colors, rewritten every frame
+	GLsizei nInstances = (GLsizei)getModelMatrices().size();
+	size_t transformBytes = nInstances * (instanceFormat == INSTANCE_COMPACT ? sizeof(BoidInstance) : sizeof(glm::mat4));
+	size_t instanceBytes = transformBytes + nInstances * sizeof(glm::vec3);
+
+	// the newest finished step is copied into persistently mapped memory
+	// when the driver allows, otherwise into an orphaned buffer
+	UploadRing ring;
+	bool useRing = !gpuSimulation && ring.create(instanceBytes);
+	GLuint instancebuffer = 0;
+	// culled boids are gathered here before the upload without the ring
+	std::vector<char> staging;
+	if (!gpuSimulation && !useRing) {
+		printf("ARB_buffer_storage not available, uploading instances with glBufferSubData\n");
+		glGenBuffers(1, &instancebuffer);
+		if (cullFlock) staging.resize(instanceBytes);
+	}
+	size_t transformSize = instanceFormat == INSTANCE_COMPACT ? sizeof(BoidInstance) : sizeof(glm::mat4);
+
+	// the flock steps on its own thread from here on
+	SimulationThread simulation;
+	if (!gpuSimulation) simulation.start(instanceFormat, fixedTimestep);
+	// steps of real time since the start, counted from the first step
+	double stepClock = (double)getStepCount();
+	uint64_t gpuStep = getStepCount();
+	double lastFrameTime = glfwGetTime();
+	// in between steps are blended here on every core before culling
+	ThreadPool blendPool(0);
+	std::vector<char> blended;
+	if (!gpuSimulation && fixedTimestep) blended.resize(transformBytes);
+
+	// CPU time per phase of the frame, GPU time from timer queries
+	FrameProfiler profiler;
+	profiler.create();
+	uint64_t lastProfiledStep = 0;
 
 	do {
-		// Measure speed
-		double currentTime = glfwGetTime();
-		nFrames++;
-		if (currentTime - lastTime >= 1.0) {
-			// printf and reset
-			printf("%f ms/frame\n", 1000.0 / double(nFrames));
-			nFrames = 0;
-			lastTime += 1.0;
-		}
+		// once a second: mean frame time and its percentiles
+		profiler.report(stdout);
+		profiler.beginFrame();
+		profiler.beginGpu();
 
 		// Clear the screen
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		// Compute the MVP matrices from keyboard and mouse inputs
-		// and updated boids
-		computeMatrices();
-		std::vector<glm::mat4> modelMatrices = getModelMatrices();
+		// Compute the MVP matrices from keyboard and mouse inputs,
+		// and take whichever step the simulation finished last
+		computeMatricesFromInputs();
 		glm::mat4 ProjectionMatrix = getProjectionMatrix();
 		glm::mat4 ViewMatrix = getViewMatrix();
+		int width, height;
+		glfwGetWindowSize(window, &width, &height);
+		profiler.lap(PHASE_INPUT);
+
+		// the GPU steps in line, the CPU simulation only hands over its
+		// newest step, timed on its own thread
+		const FlockSnapshot* snapshot = NULL;
+		if (!gpuSimulation) {
+			snapshot = &simulation.latest();
+			if (snapshot->step != lastProfiledStep) {
+				profiler.record(PHASE_STEP, snapshot->stepMs);
+				lastProfiledStep = snapshot->step;
+			}
+		}
+		uint64_t newestStep = gpuSimulation ? gpuStep : snapshot->step;
+		double frameTime = glfwGetTime();
+		stepClock += (frameTime - lastFrameTime) * stepRate;
+		lastFrameTime = frameTime;
+		stepClock = std::min(stepClock, (double)(newestStep + maxCatchUpSteps));
+		// where the flock is drawn between the step before the newest (0)
+		// and the newest (1)
+		float alpha = 1;
+		if (!fixedTimestep && gpuSimulation) {
+			gpu.step();
+			gpuStep++;
+		}
+		else if (!fixedTimestep) {
+			// one step per frame
+			simulation.runUntil(newestStep + 1);
+		}
+		else if (gpuSimulation) {
+			// zero or more steps in line, drawn as they are
+			for (; gpuStep < (uint64_t)stepClock; gpuStep++) gpu.step();
+		}
+		else {
+			// kept a step ahead, so the step the clock is heading to is
+			// usually done by the time it gets there
+			simulation.runUntil((uint64_t)stepClock + 1);
+			alpha = (float)std::max(0.0, std::min(1.0, stepClock - (double)newestStep + 1));
+		}
+		const BoidInstance* instances = snapshot ? snapshot->instances.data() : NULL;
+		const glm::mat4* modelMatrices = snapshot ? snapshot->modelMatrices.data() : NULL;
+		if (alpha < 1) {
+			if (instanceFormat == INSTANCE_COMPACT) {
+				interpolateInstances(*snapshot, alpha, blendPool, (BoidInstance*)blended.data());
+				instances = (const BoidInstance*)blended.data();
+			}
+			else {
+				interpolateModelMatrices(*snapshot, alpha, blendPool, (glm::mat4*)blended.data());
+				modelMatrices = (const glm::mat4*)blended.data();
+			}
+		}
+		profiler.lap(PHASE_SIMULATION);
 
-		std::vector<glm::vec3> boidColors = getBoidColors();
-
-		glBindVertexArray(VertexArrayID);
-
-		for (int i = 0; i < nBoids; i++) {
-			// todo: why are they disappearing
-
-			glm::mat4 ModelMatrix = modelMatrices[i];
-			glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
-			glm::vec3 boidColor = boidColors[i];
-
-			// Send our transformation to the currently bound shader,
-			// in the "MVP" uniform
-			glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-			glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
-			glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
-			// Set boid color
-			glUniform3f(DiffuseColorID, boidColor.x, boidColor.y, boidColor.z);
-
-			// Draw a boid!
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-			glDrawElements(
+		// boids drawn per LOD tier, starting at tierFirst in the instance data
+		GLsizei tierFirst[LOD_TIERS] = { 0, 0, 0 };
+		GLsizei tierCount[LOD_TIERS] = { nInstances, 0, 0 };
+		if (gpuSimulation) {
+			// nothing to upload, the step writes what the draw reads
+		}
+		else if (cullFlock) {
+			char* region = useRing ? (char*)ring.beginFrame() : staging.data();
+			glm::vec3* colors = (glm::vec3*)(region + transformBytes);
+			if (instanceFormat == INSTANCE_COMPACT) {
+				culler.cull(instances, snapshot->colors.data(), nInstances, ViewMatrix, ProjectionMatrix, (float)height, (BoidInstance*)region, colors);
+			}
+			else {
+				culler.cull(modelMatrices, snapshot->colors.data(), nInstances, ViewMatrix, ProjectionMatrix, (float)height, (glm::mat4*)region, colors);
+			}
+			for (int tier = 0; tier < LOD_TIERS; tier++) {
+				tierFirst[tier] = culler.first((LodTier)tier);
+				tierCount[tier] = culler.count((LodTier)tier);
+			}
+			if (!useRing) {
+				// only the visible boids go over the bus
+				GLsizei visible = tierFirst[LOD_POINT] + tierCount[LOD_POINT];
+				glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
+				glBufferData(GL_ARRAY_BUFFER, instanceBytes, NULL, GL_STREAM_DRAW);
+				glBufferSubData(GL_ARRAY_BUFFER, 0, visible * transformSize, region);
+				glBufferSubData(GL_ARRAY_BUFFER, transformBytes, visible * sizeof(glm::vec3), colors);
+			}
+		}
+		else if (useRing) {
+			const void* transforms = instanceFormat == INSTANCE_COMPACT ? (const void*)instances : (const void*)modelMatrices;
+			char* region = (char*)ring.beginFrame();
+			memcpy(region, transforms, transformBytes);
+			memcpy(region + transformBytes, snapshot->colors.data(), instanceBytes - transformBytes);
+		}
+		else {
+			const void* transforms = instanceFormat == INSTANCE_COMPACT ? (const void*)instances : (const void*)modelMatrices;
+			// orphan last frame's storage so the driver never waits on it
+			glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
+			glBufferData(GL_ARRAY_BUFFER, instanceBytes, NULL, GL_STREAM_DRAW);
+			glBufferSubData(GL_ARRAY_BUFFER, 0, transformBytes, transforms);
+			glBufferSubData(GL_ARRAY_BUFFER, transformBytes, instanceBytes - transformBytes, snapshot->colors.data());
+		}
+		profiler.lap(PHASE_UPLOAD);
+
+		glm::mat4 ViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
+		GLuint instanceSource = useRing ? ring.buffer() : instancebuffer;
+		size_t regionOffset = useRing ? ring.regionOffset() : 0;
+
+		// full arrows up close, simplified ones further out, one call each
+		glUseProgram(programID);
+		glUniformMatrix4fv(ViewProjectionMatrixID, 1, GL_FALSE, &ViewProjectionMatrix[0][0]);
+		glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
+		for (int tier = LOD_FULL; tier <= LOD_SIMPLE; tier++) {
+			if (tierCount[tier] == 0) continue;
+			glBindVertexArray(meshes[tier].vertexArray);
+			if (gpuSimulation) {
+				// front and back swap every step
+				gpu.bindInstanceAttributes();
+			}
+			else {
+				bindInstanceAttributes(instanceSource, regionOffset + tierFirst[tier] * transformSize, regionOffset + transformBytes + tierFirst[tier] * sizeof(glm::vec3));
+			}
+			glDrawElementsInstanced(
 				GL_TRIANGLES,
-				indices.size(),
-				GL_UNSIGNED_SHORT,
-				(void*)0
+				meshes[tier].indexCount,
+				meshes[tier].indexType,
+				(void*)0,
+				tierCount[tier]
 			);
 		}
 
+		// and a single point for each boid in the distance
+		if (tierCount[LOD_POINT] > 0) {
+			glUseProgram(pointProgramID);
+			glUniformMatrix4fv(PointViewProjectionMatrixID, 1, GL_FALSE, &ViewProjectionMatrix[0][0]);
+			glUniformMatrix4fv(PointViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
+			// arrow width on screen at distance 1
+			glUniform1f(PointScaleID, (arrowMax.x - arrowMin.x) * ProjectionMatrix[1][1] * height * 0.5f);
+			glBindVertexArray(pointVertexArray);
+			bindPointAttributes(instanceSource, regionOffset + tierFirst[LOD_POINT] * transformSize, regionOffset + transformBytes + tierFirst[LOD_POINT] * sizeof(glm::vec3));
+			glDrawArraysInstanced(GL_POINTS, 0, 1, tierCount[LOD_POINT]);
+		}
+		if (useRing) ring.endFrame();
+
 		glBindVertexArray(0);
+		profiler.endGpu();
+		profiler.lap(PHASE_DRAW);
 
 		// Swap buffers
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+		profiler.lap(PHASE_SWAP);
+		profiler.endFrame();
 
 	} while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
 		glfwWindowShouldClose(window) == 0);
 
-	glDeleteBuffers(1, &elementbuffer);
-	glDeleteBuffers(1, &vertexbuffer);
-	glDeleteBuffers(1, &uvbuffer);
-	glDeleteBuffers(1, &normalbuffer);
+	if (profilePath) {
+		std::string csvPath = std::string(profilePath) + ".csv", jsonPath = std::string(profilePath) + ".json";
+		FILE* csv = fopen(csvPath.c_str(), "w");
+		if (csv) {
+			profiler.writeCsv(csv);
+			fclose(csv);
+		}
+		FILE* json = fopen(jsonPath.c_str(), "w");
+		if (json) {
+			profiler.writeJson(json);
+			fclose(json);
+		}
+		printf("Frame profile written to %s and %s\n", csvPath.c_str(), jsonPath.c_str());
+	}
+	profiler.destroy();
+	deleteMesh(meshes[LOD_FULL]);
+	deleteMesh(meshes[LOD_SIMPLE]);
+	glDeleteVertexArrays(1, &pointVertexArray);
+	simulation.stop();
+#ifdef BOIDS_TRACE
+	// the simulation is stopped, so every ring is quiet
+	if (writeTrace("boids_trace.json")) printf("Trace written to boids_trace.json\n");
+#endif
+	gpu.destroy();
+	ring.destroy();
+	if (instancebuffer) glDeleteBuffers(1, &instancebuffer);
 	glDeleteProgram(programID);
-	glDeleteVertexArrays(1, &VertexArrayID);
+	glDeleteProgram(pointProgramID);
 	// Close OpenGL window and terminate GLFW
 	glfwTerminate();
 
@@ -0,0 +1,232 @@
+// runs the flock without a window or GL context, for batch jobs and profiling
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <glm/glm.hpp>
+
+#include "boids.hpp"
+#include "checkpoint.hpp"
+#include "flock.hpp"
+#include "trace.hpp"
+#include "trajectory.hpp"
+
+void printUsage(const char* program) {
+	printf("usage: %s [options]\n", program);
+	printf("  -n <count>         boids in the flock (default 10000)\n");
+	printf("  -steps <count>     steps to simulate (default 1000)\n");
+	printf("  -seed <value>      random seed (default random)\n");
+	printf("  -threads <count>   simulation threads, 0 = one per core (default 0)\n");
+	printf("  -simd <level>      scalar, sse2, avx2 or avx512 for -brute (default widest supported)\n");
+	printf("  -brute             compare every pair instead of using the spatial grid\n");
+	printf("  -lists             keep neighbor lists across steps (Verlet lists)\n");
+	printf("  -skin <value>      extra range of the neighbor lists (default 1)\n");
+	printf("  -inplace           original serial in place update\n");
+	printf("  -adaptive          steer boids without neighbors less often\n");
+	printf("  -trace <file>      write a Chrome trace of the run, needs a BOIDS_TRACE build\n");
+	printf("  -record <file>     record every step's flock to a trajectory file\n");
+	printf("  -keyframe <count>  steps between whole flocks in the recording (default 32)\n");
+	printf("  -replay <file>     play a recording back instead of simulating\n");
+	printf("  -load <file>       resume from a checkpoint, with its parameters and seed\n");
+	printf("  -save <file>       write a checkpoint at the end of the run\n");
+	printf("  -saveevery <count> also write it every count steps\n");
+	printf("  -radius -cohesion -noise -A -r0 -gravity -dt <value>\n");
+	printf("                     simulation parameters\n");
+}
+
+// plays every recorded step through setFlockState, then seeks around
+int replay(const char* path, int nThreads) {
+	TrajectoryReader reader;
+	if (!reader.open(path, nThreads)) {
+		fprintf(stderr, "Can't open recording %s\n", path);
+		return -1;
+	}
+	printf("%u boids, %zu recorded steps from %llu to %llu\n", reader.boids(), reader.records(),
+		(unsigned long long)reader.firstStep(), (unsigned long long)reader.lastStep());
+	if (reader.records() == 0) return 0;
+
+	FlockState state;
+	uint64_t step = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	size_t played = 0;
+	while (reader.next(state, &step)) {
+		setFlockState(state, step);
+		played++;
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	if (played != reader.records()) {
+		fprintf(stderr, "Recording is damaged after step %llu\n", (unsigned long long)step);
+		return -1;
+	}
+	printf("%f steps/sec played back, %f ms/step\n", played / seconds, 1000.0 * seconds / played);
+
+	// backwards through the recording, the worst case for scrubbing
+	const int seeks = 20;
+	uint64_t first = reader.firstStep(), span = reader.lastStep() - first;
+	start = std::chrono::steady_clock::now();
+	for (int i = seeks - 1; i >= 0; i--) {
+		if (!reader.seek(first + span * i / (seeks - 1), state, &step)) return -1;
+		setFlockState(state, step);
+	}
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("%f ms/seek\n", 1000.0 * seconds / seeks);
+	return 0;
+}
+
+int main(int argc, char* argv[]) {
+	int nBoids = 10000;
+	int nSteps = 1000;
+	int nThreads = 0;
+	SimdLevel simdLevel = SIMD_AVX512;
+	BoidParams params = getBoidParams();
+	const char* tracePath = NULL;
+	const char* recordPath = NULL;
+	const char* replayPath = NULL;
+	int keyframeInterval = 32;
+	const char* loadPath = NULL;
+	const char* savePath = NULL;
+	int saveEvery = 0;
+	bool useLists = false;
+	TRACE_THREAD_NAME("main");
+
+	for (int i = 1; i < argc; i++) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : "";
+
+		// flags without a value
+		if (strcmp(arg, "-brute") == 0) { setNeighborSearch(BRUTE_FORCE); continue; }
+		if (strcmp(arg, "-lists") == 0) { setNeighborSearch(NEIGHBOR_LIST); useLists = true; continue; }
+		if (strcmp(arg, "-inplace") == 0) { setIntegrationMode(IN_PLACE); continue; }
+		if (strcmp(arg, "-adaptive") == 0) { setUpdateSchedule(UPDATE_BY_ACTIVITY); continue; }
+		if (strcmp(arg, "-h") == 0 || strcmp(arg, "-help") == 0) { printUsage(argv[0]); return 0; }
+
+		if (strcmp(arg, "-n") == 0) nBoids = atoi(value);
+		else if (strcmp(arg, "-steps") == 0) nSteps = atoi(value);
+		else if (strcmp(arg, "-seed") == 0) setSeed(strtoull(value, NULL, 0));
+		else if (strcmp(arg, "-threads") == 0) nThreads = atoi(value);
+		else if (strcmp(arg, "-trace") == 0) tracePath = value;
+		else if (strcmp(arg, "-record") == 0) recordPath = value;
+		else if (strcmp(arg, "-keyframe") == 0) keyframeInterval = atoi(value);
+		else if (strcmp(arg, "-replay") == 0) replayPath = value;
+		else if (strcmp(arg, "-load") == 0) loadPath = value;
+		else if (strcmp(arg, "-save") == 0) savePath = value;
+		else if (strcmp(arg, "-saveevery") == 0) saveEvery = atoi(value);
+		else if (strcmp(arg, "-radius") == 0) params.radius = (float)atof(value);
+		else if (strcmp(arg, "-cohesion") == 0) params.cohesion = (float)atof(value);
+		else if (strcmp(arg, "-noise") == 0) params.noise = (float)atof(value);
+		else if (strcmp(arg, "-A") == 0) params.A = (float)atof(value);
+		else if (strcmp(arg, "-r0") == 0) params.r0 = (float)atof(value);
+		else if (strcmp(arg, "-gravity") == 0) params.gravity = (float)atof(value);
+		else if (strcmp(arg, "-dt") == 0) params.dt = (float)atof(value);
+		else if (strcmp(arg, "-skin") == 0) setNeighborSkin((float)atof(value));
+		else if (strcmp(arg, "-simd") == 0) {
+			if (strcmp(value, "scalar") == 0) simdLevel = SIMD_SCALAR;
+			else if (strcmp(value, "sse2") == 0) simdLevel = SIMD_SSE2;
+			else if (strcmp(value, "avx2") == 0) simdLevel = SIMD_AVX2;
+			else if (strcmp(value, "avx512") == 0) simdLevel = SIMD_AVX512;
+			else {
+				fprintf(stderr, "Unknown SIMD level %s\n", value);
+				return -1;
+			}
+		}
+		else {
+			fprintf(stderr, "Unknown option %s\n", arg);
+			printUsage(argv[0]);
+			return -1;
+		}
+		i++;
+	}
+
+	if (replayPath) {
+		setThreadCount(nThreads);
+		return replay(replayPath, nThreads);
+	}
+
+	if (nBoids <= 0 || nSteps <= 0) {
+		fprintf(stderr, "Need at least one boid and one step\n");
+		return -1;
+	}
+
+	setBoidParams(params);
+	setThreadCount(nThreads);
+	simdLevel = setSimdLevel(simdLevel);
+
+	if (loadPath) {
+		if (!loadCheckpoint(loadPath)) {
+			fprintf(stderr, "Can't load checkpoint %s\n", loadPath);
+			return -1;
+		}
+		nBoids = (int)getFlockState().size();
+		printf("Resumed %s at step %llu\n", loadPath, (unsigned long long)getStepCount());
+	}
+
+	printf("%d boids, %d steps, seed %llu, %d threads, %s\n",
+		nBoids, nSteps, (unsigned long long)getSeed(), getThreadCount(), simdLevelName(simdLevel));
+
+	if (!loadPath) createBoids(nBoids);
+
+	TrajectoryRecorder recorder;
+	if (recordPath) {
+		if (!recorder.open(recordPath, keyframeInterval, nThreads)) {
+			fprintf(stderr, "Can't write a recording to %s\n", recordPath);
+			return -1;
+		}
+		recorder.record(getFlockState(), getStepCount());
+	}
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double lastReport = 0;
+	double steered = 0;
+	for (int step = 0; step < nSteps; step++) {
+		computeBoidModelMatrices();
+		steered += getSteeredBoidCount();
+		if (recordPath && !recorder.record(getFlockState(), getStepCount())) {
+			fprintf(stderr, "Recording to %s failed at step %llu\n", recordPath, (unsigned long long)getStepCount());
+			return -1;
+		}
+		if (savePath && saveEvery > 0 && (step + 1) % saveEvery == 0 && !saveCheckpoint(savePath)) {
+			fprintf(stderr, "Can't write checkpoint %s\n", savePath);
+			return -1;
+		}
+
+		// progress once a second for long runs
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		if (elapsed - lastReport >= 1.0) {
+			printf("step %d, %f steps/sec\n", step + 1, (step + 1) / elapsed);
+			lastReport = elapsed;
+		}
+	}
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("%f steps/sec, %f ms/step, %.3e boid steps/sec\n",
+		nSteps / seconds, 1000.0 * seconds / nSteps, (double)nBoids * nSteps / seconds);
+	printf("%.1f%% of boid steps steered\n", 100.0 * steered / ((double)nBoids * nSteps));
+	if (useLists) printf("neighbor lists built %llu times\n", (unsigned long long)getNeighborListBuilds());
+
+	if (savePath) {
+		if (!saveCheckpoint(savePath)) {
+			fprintf(stderr, "Can't write checkpoint %s\n", savePath);
+			return -1;
+		}
+		printf("Checkpoint at step %llu written to %s\n", (unsigned long long)getStepCount(), savePath);
+	}
+
+	if (recordPath) {
+		uint64_t bytes = recorder.bytesWritten();
+		uint64_t records = recorder.records();
+		if (!recorder.close()) {
+			fprintf(stderr, "Recording to %s failed\n", recordPath);
+			return -1;
+		}
+		printf("Recorded %llu steps to %s, %.2f bytes/boid step\n", (unsigned long long)records, recordPath,
+			(double)bytes / ((double)records * nBoids));
+	}
+
+	if (tracePath) {
+		if (writeTrace(tracePath)) printf("Trace written to %s\n", tracePath);
+		else fprintf(stderr, "Can't write a trace to %s, is this a BOIDS_TRACE build?\n", tracePath);
+	}
+
+	return 0;
+}
@@ -0,0 +1,83 @@
+#include <atomic>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "neighborlist.hpp"
+#include "threadpool.hpp"
+#include "trace.hpp"
+
+// points per parallel chunk
+static const int ListChunk = 1024;
+
+bool NeighborList::refresh(const float* x, const float* y, const float* z, size_t count,
+	float radius, float skin, float margin, ThreadPool& pool) {
+	bool stale = count != builtX.size() || radius != builtRadius || skin != builtSkin ||
+		nBuilds == 0 || moved(x, y, z, skin / 2 - margin, pool);
+	if (!stale) return false;
+
+	builtRadius = radius;
+	builtSkin = skin;
+	build(x, y, z, count, pool);
+	return true;
+}
+
+bool NeighborList::moved(const float* x, const float* y, const float* z, float limit, ThreadPool& pool) const {
+	if (limit <= 0) return true;
+	float limit2 = limit * limit;
+	std::atomic<bool> any{ false };
+	pool.parallelFor((int)builtX.size(), ListChunk, [&](int begin, int end) {
+		if (any.load(std::memory_order_relaxed)) return;
+		for (int i = begin; i < end; i++) {
+			float dx = x[i] - builtX[i], dy = y[i] - builtY[i], dz = z[i] - builtZ[i];
+			if (dx * dx + dy * dy + dz * dz > limit2) {
+				any.store(true, std::memory_order_relaxed);
+				return;
+			}
+		}
+	});
+	return any.load();
+}
+
+int NeighborList::collect(int i, const float* x, const float* y, const float* z, float cutoff2, int* out) const {
+	CandidateRange ranges[27];
+	int nRanges = grid.candidateRanges(glm::vec3(x[i], y[i], z[i]), ranges);
+	const int* ids = grid.indices();
+	int found = 0;
+	for (int r = 0; r < nRanges; r++) {
+		for (int k = ranges[r].begin; k < ranges[r].end; k++) {
+			int j = ids[k];
+			if (j == i) continue;
+			float dx = x[i] - x[j], dy = y[i] - y[j], dz = z[i] - z[j];
+			if (dx * dx + dy * dy + dz * dz < cutoff2) {
+				if (out) out[found] = j;
+				found++;
+			}
+		}
+	}
+	return found;
+}
+
+void NeighborList::build(const float* x, const float* y, const float* z, size_t count, ThreadPool& pool) {
+	TRACE_SCOPE("neighborListBuild");
+	float cutoff = builtRadius + builtSkin;
+	float cutoff2 = cutoff * cutoff;
+	int n = (int)count;
+	grid.build(x, y, z, count, cutoff);
+
+	// count each row, then fill it, both passes visit candidates alike
+	rowStart.assign(count + 1, 0);
+	pool.parallelFor(n, ListChunk, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) rowStart[i + 1] = collect(i, x, y, z, cutoff2, NULL);
+	});
+	for (int i = 0; i < n; i++) rowStart[i + 1] += rowStart[i];
+	neighbors.resize(rowStart[n]);
+	pool.parallelFor(n, ListChunk, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) collect(i, x, y, z, cutoff2, neighbors.data() + rowStart[i]);
+	});
+
+	builtX.assign(x, x + count);
+	builtY.assign(y, y + count);
+	builtZ.assign(z, z + count);
+	nBuilds++;
+}
@@ -0,0 +1,55 @@
+#ifndef NEIGHBORLIST_HPP
+#define NEIGHBORLIST_HPP
+
+#include <cstdint>
+#include <vector>
+
+#include "flock.hpp"
+#include "spatialgrid.hpp"
+
+class ThreadPool;
+
+// Verlet neighbor lists: every point's candidates within radius + skin,
+// found once through a SpatialGrid and reused for as many steps as they
+// stay complete. Points move at most |vel| * dt a step, so as long as none
+// moved more than skin / 2 since the build, every pair now within radius
+// was within radius + skin then. Stored compressed sparse row, point i's
+// candidates are indices()[first(i), first(i + 1)).
+class NeighborList {
+public:
+	// rebuilds the lists if the count, radius or skin changed or some point
+	// moved more than skin / 2 - margin since the last build. margin covers
+	// movement while the lists are in use, e.g. an in place step. Returns
+	// whether it rebuilt
+	bool refresh(const float* x, const float* y, const float* z, size_t count,
+		float radius, float skin, float margin, ThreadPool& pool);
+
+	// candidates of point i as one run of indices(), callers still have to
+	// check distances
+	CandidateRange candidates(int i) const {
+		CandidateRange range = { rowStart[i], rowStart[i + 1] };
+		return range;
+	}
+	const int* indices() const { return neighbors.data(); }
+	size_t pairs() const { return neighbors.size(); }
+	uint64_t builds() const { return nBuilds; }
+
+private:
+	void build(const float* x, const float* y, const float* z, size_t count, ThreadPool& pool);
+	bool moved(const float* x, const float* y, const float* z, float limit, ThreadPool& pool) const;
+	// candidates of point i within the cutoff, written to out unless NULL
+	int collect(int i, const float* x, const float* y, const float* z, float cutoff2, int* out) const;
+
+	SpatialGrid grid;
+	float builtRadius = 0;
+	float builtSkin = 0;
+	uint64_t nBuilds = 0;
+	// row offsets, one more than points
+	std::vector<int> rowStart;
+	// read by the vector kernels, which load past the last entry
+	AlignedVector<int> neighbors;
+	// positions at the last build
+	AlignedVector<float> builtX, builtY, builtZ;
+};
+
+#endif
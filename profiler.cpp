@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <cmath>
+
+#include "profiler.hpp"
+#include "trace.hpp"
+
+static const double HistogramMinMs = 0.001;
+static const double HistogramGrowth = 1.05;
+
+const char* framePhaseName(FramePhase phase) {
+	static const char* names[FRAME_PHASES] = { "input", "simulation", "upload", "draw", "swap", "step", "gpu", "frame" };
+	return phase < FRAME_PHASES ? names[phase] : "";
+}
+
+void LatencyHistogram::add(double ms) {
+	int bucket = 0;
+	if (ms > HistogramMinMs) bucket = std::min(Buckets - 1, (int)(std::log(ms / HistogramMinMs) / std::log(HistogramGrowth)) + 1);
+	buckets[bucket]++;
+	samples++;
+	sum += ms;
+	largest = std::max(largest, ms);
+}
+
+void LatencyHistogram::clear() {
+	*this = LatencyHistogram();
+}
+
+double LatencyHistogram::percentile(double p) const {
+	if (samples == 0) return 0;
+	long long rank = std::max(1LL, (long long)std::ceil(p * samples));
+	long long seen = 0;
+	for (int bucket = 0; bucket < Buckets; bucket++) {
+		seen += buckets[bucket];
+		if (seen < rank) continue;
+		if (bucket == 0) return std::min(HistogramMinMs, largest);
+		// middle of the bucket, never past the largest sample
+		double middle = HistogramMinMs * std::pow(HistogramGrowth, bucket - 0.5);
+		return std::min(middle, largest);
+	}
+	return largest;
+}
+
+void FrameProfiler::create() {
+	destroy();
+	glGenQueries(GpuQueries, queries);
+	nextQuery = 0;
+	gpuSamples = 0;
+}
+
+void FrameProfiler::destroy() {
+	if (queries[0]) glDeleteQueries(GpuQueries, queries);
+	for (int q = 0; q < GpuQueries; q++) {
+		queries[q] = 0;
+		pending[q] = false;
+	}
+	gpuActive = false;
+}
+
+void FrameProfiler::beginFrame() {
+	frameStart = lastLap = Clock::now();
+	if (!started) {
+		windowStart = frameStart;
+		started = true;
+	}
+	collectGpu(false);
+}
+
+#ifdef BOIDS_TRACE
+static uint64_t traceTime(std::chrono::steady_clock::time_point time) {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+#endif
+
+void FrameProfiler::lap(FramePhase phase) {
+	Clock::time_point now = Clock::now();
+	add(phase, std::chrono::duration<double, std::milli>(now - lastLap).count());
+#ifdef BOIDS_TRACE
+	// the phases double as trace markers
+	traceRecord(framePhaseName(phase), traceTime(lastLap), traceTime(now));
+#endif
+	lastLap = now;
+}
+
+void FrameProfiler::beginGpu() {
+	if (!queries[0] || gpuActive) return;
+	// every query in flight, wait for the oldest rather than drop a frame
+	if (pending[nextQuery]) collectGpu(true);
+	glBeginQuery(GL_TIME_ELAPSED, queries[nextQuery]);
+	gpuActive = true;
+}
+
+void FrameProfiler::endGpu() {
+	if (!gpuActive) return;
+	glEndQuery(GL_TIME_ELAPSED);
+	pending[nextQuery] = true;
+	nextQuery = (nextQuery + 1) % GpuQueries;
+	gpuActive = false;
+}
+
+void FrameProfiler::record(FramePhase phase, double ms) {
+	add(phase, ms);
+}
+
+void FrameProfiler::endFrame() {
+	Clock::time_point now = Clock::now();
+	add(PHASE_FRAME, std::chrono::duration<double, std::milli>(now - frameStart).count());
+#ifdef BOIDS_TRACE
+	traceRecord(framePhaseName(PHASE_FRAME), traceTime(frameStart), traceTime(now));
+#endif
+}
+
+// results come back in the order the queries were issued
+void FrameProfiler::collectGpu(bool wait) {
+	for (int i = 0; i < GpuQueries; i++) {
+		int q = (nextQuery + i) % GpuQueries;
+		if (!pending[q]) continue;
+		GLint available = GL_FALSE;
+		if (!wait) glGetQueryObjectiv(queries[q], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!wait && !available) return;
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(queries[q], GL_QUERY_RESULT, &nanoseconds);
+		pending[q] = false;
+		// the first query after creation can time from an arbitrary
+		// start on some drivers (llvmpipe), treat it as warm up
+		if (gpuSamples++ > 0) add(PHASE_GPU, nanoseconds * 1e-6);
+		// only the oldest is needed to free a query
+		if (wait) return;
+	}
+}
+
+void FrameProfiler::add(FramePhase phase, double ms) {
+	totals[phase].add(ms);
+	window[phase].add(ms);
+}
+
+bool FrameProfiler::report(FILE* out) {
+	if (!started || Clock::now() - windowStart < std::chrono::seconds(1)) return false;
+	const LatencyHistogram& frames = window[PHASE_FRAME];
+	fprintf(out, "%f ms/frame  p50 %.2f  p95 %.2f  p99 %.2f  max %.2f ms\n", frames.mean(),
+		frames.percentile(0.50), frames.percentile(0.95), frames.percentile(0.99), frames.max());
+	for (int phase = 0; phase < FRAME_PHASES; phase++) window[phase].clear();
+	windowStart += std::chrono::seconds(1);
+	return true;
+}
+
+void FrameProfiler::writeCsv(FILE* out) const {
+	fprintf(out, "phase,samples,mean_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+	for (int phase = 0; phase < FRAME_PHASES; phase++) {
+		const LatencyHistogram& h = totals[phase];
+		fprintf(out, "%s,%lld,%.6f,%.6f,%.6f,%.6f,%.6f\n", framePhaseName((FramePhase)phase), h.count(),
+			h.mean(), h.percentile(0.50), h.percentile(0.95), h.percentile(0.99), h.max());
+	}
+}
+
+void FrameProfiler::writeJson(FILE* out) const {
+	fprintf(out, "{\n  \"phases\": [\n");
+	for (int phase = 0; phase < FRAME_PHASES; phase++) {
+		const LatencyHistogram& h = totals[phase];
+		fprintf(out, "    {\"phase\": \"%s\", \"samples\": %lld, \"mean_ms\": %.6f, \"p50_ms\": %.6f, \"p95_ms\": %.6f, \"p99_ms\": %.6f, \"max_ms\": %.6f}%s\n",
+			framePhaseName((FramePhase)phase), h.count(), h.mean(), h.percentile(0.50), h.percentile(0.95), h.percentile(0.99), h.max(),
+			phase + 1 < FRAME_PHASES ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+}
@@ -0,0 +1,55 @@
+#ifndef RNG_HPP
+#define RNG_HPP
+
+#include <cstdint>
+
+// Philox4x32-10 counter based generator (Salmon et al., "Parallel random
+// numbers: as easy as 1, 2, 3", SC 2011). Output is a pure function of
+// a 128 bit counter and a 64 bit key, so there is no state to seed, share
+// or lock: any thread can draw the numbers for (seed, step, boid) directly,
+// and the same seed always replays the same numbers.
+struct Philox4x32 {
+	uint32_t v[4];
+};
+
+inline void philoxMulHiLo(uint32_t a, uint32_t b, uint32_t& hi, uint32_t& lo) {
+	uint64_t product = (uint64_t)a * b;
+	hi = (uint32_t)(product >> 32);
+	lo = (uint32_t)product;
+}
+
+inline Philox4x32 philox4x32(uint32_t c0, uint32_t c1, uint32_t c2, uint32_t c3, uint64_t key) {
+	uint32_t k0 = (uint32_t)key;
+	uint32_t k1 = (uint32_t)(key >> 32);
+	for (int round = 0; round < 10; round++) {
+		uint32_t hi0, lo0, hi1, lo1;
+		philoxMulHiLo(0xD2511F53u, c0, hi0, lo0);
+		philoxMulHiLo(0xCD9E8D57u, c2, hi1, lo1);
+		uint32_t n0 = hi1 ^ c1 ^ k0;
+		uint32_t n2 = hi0 ^ c3 ^ k1;
+		c0 = n0; c1 = lo1; c2 = n2; c3 = lo0;
+		k0 += 0x9E3779B9u;
+		k1 += 0xBB67AE85u;
+	}
+	Philox4x32 out = { { c0, c1, c2, c3 } };
+	return out;
+}
+
+// streams keep draws for different purposes apart under the same seed
+enum RngStream { RNG_SPAWN = 1, RNG_NOISE = 2 };
+
+inline Philox4x32 boidRandom(uint64_t seed, RngStream stream, uint64_t step, uint32_t boid) {
+	return philox4x32(boid, (uint32_t)step, (uint32_t)(step >> 32), (uint32_t)stream, seed);
+}
+
+// uniform float in [-1, 1) from the top 24 bits
+inline float randomSigned(uint32_t bits) {
+	return (float)(int32_t)(bits & 0xFFFFFF00u) * (1.0f / 2147483648.0f);
+}
+
+// uniform integer in [lo, hi] without the bias of a modulo
+inline int randomRange(uint32_t bits, int lo, int hi) {
+	return lo + (int)(((uint64_t)bits * (uint64_t)(hi - lo + 1)) >> 32);
+}
+
+#endif
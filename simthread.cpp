@@ -0,0 +1,134 @@
+#include <chrono>
+
+#include "simthread.hpp"
+#include "flock.hpp"
+#include "threadpool.hpp"
+#include "trace.hpp"
+
+void SimulationThread::start(InstanceFormat newFormat, bool keepPrevious) {
+	stop();
+	format = newFormat;
+	previous = keepPrevious;
+
+	// every slot starts out as the freshly created flock
+	const FlockState& flock = getFlockState();
+	for (int s = 0; s < 3; s++) {
+		FlockSnapshot& snapshot = snapshots[s];
+		snapshot.modelMatrices.clear();
+		snapshot.instances.clear();
+		if (format == INSTANCE_COMPACT) {
+			snapshot.instances.resize(flock.size());
+			for (int i = 0; i < (int)flock.size(); i++) {
+				snapshot.instances[i].position = flock.position(i);
+				snapshot.instances[i].heading = flock.velocity(i);
+			}
+		}
+		else {
+			snapshot.modelMatrices = getModelMatrices();
+		}
+		// until the first step the flock was standing still
+		snapshot.previousInstances.clear();
+		snapshot.previousModelMatrices.clear();
+		if (previous) {
+			snapshot.previousInstances = snapshot.instances;
+			snapshot.previousModelMatrices = snapshot.modelMatrices;
+		}
+		snapshot.colors = getBoidColors();
+		snapshot.step = getStepCount();
+	}
+	writeSlot = 0;
+	readSlot = 1;
+	publishedSlot = 2;
+	ready.store(2);
+	target.store(getStepCount() + 1);
+
+	stopping.store(false);
+	thread = std::thread(&SimulationThread::run, this);
+}
+
+void SimulationThread::stop() {
+	if (!thread.joinable()) return;
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		stopping.store(true);
+	}
+	wake.notify_one();
+	thread.join();
+	setInstanceOutput(NULL, NULL);
+}
+
+const FlockSnapshot& SimulationThread::latest() {
+	if (ready.load(std::memory_order_acquire) & FreshBit) {
+		// trade the slot we were reading for the newest one
+		readSlot = (int)(ready.exchange((unsigned)readSlot, std::memory_order_acq_rel) & ~FreshBit);
+	}
+	return snapshots[readSlot];
+}
+
+void SimulationThread::runUntil(uint64_t step) {
+	if (step <= target.load()) return;
+	{
+		std::lock_guard<std::mutex> lock(wakeMutex);
+		target.store(step);
+	}
+	wake.notify_one();
+}
+
+void SimulationThread::run() {
+	TRACE_THREAD_NAME("simulation");
+	while (true) {
+		// wait until the renderer lets us step further
+		{
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wake.wait(lock, [this] {
+				return stopping.load() || getStepCount() < target.load();
+			});
+			if (stopping.load()) return;
+		}
+
+		FlockSnapshot& snapshot = snapshots[writeSlot];
+		// the last published slot is only ever read until we publish again
+		if (previous) {
+			const FlockSnapshot& last = snapshots[publishedSlot];
+			if (format == INSTANCE_COMPACT) snapshot.previousInstances = last.instances;
+			else snapshot.previousModelMatrices = last.modelMatrices;
+		}
+		if (format == INSTANCE_COMPACT) setCompactInstanceOutput(snapshot.instances.data(), snapshot.colors.data());
+		else setInstanceOutput(snapshot.modelMatrices.data(), snapshot.colors.data());
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		computeBoidModelMatrices();
+		snapshot.stepMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		snapshot.step = getStepCount();
+
+		// publish it, the slot the renderer gave back is the next to fill
+		publishedSlot = writeSlot;
+		writeSlot = (int)(ready.exchange((unsigned)writeSlot | FreshBit, std::memory_order_acq_rel) & ~FreshBit);
+	}
+}
+
+// boids per parallel chunk, enough to amortize the hand out
+static const int InterpolationChunk = 4096;
+
+void interpolateInstances(const FlockSnapshot& snapshot, float alpha, ThreadPool& pool, BoidInstance* out) {
+	const BoidInstance* from = snapshot.previousInstances.data();
+	const BoidInstance* to = snapshot.instances.data();
+	int n = (int)snapshot.instances.size();
+	pool.parallelFor(n, InterpolationChunk, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			out[i].position = glm::mix(from[i].position, to[i].position, alpha);
+			out[i].heading = glm::mix(from[i].heading, to[i].heading, alpha);
+		}
+	});
+}
+
+void interpolateModelMatrices(const FlockSnapshot& snapshot, float alpha, ThreadPool& pool, glm::mat4* out) {
+	const glm::mat4* from = snapshot.previousModelMatrices.data();
+	const glm::mat4* to = snapshot.modelMatrices.data();
+	int n = (int)snapshot.modelMatrices.size();
+	pool.parallelFor(n, InterpolationChunk, [&](int begin, int end) {
+		for (int i = begin; i < end; i++) {
+			out[i] = to[i];
+			out[i][3] = glm::mix(from[i][3], to[i][3], alpha);
+		}
+	});
+}
@@ -0,0 +1,90 @@
+#ifndef SIMTHREAD_HPP
+#define SIMTHREAD_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "boids.hpp"
+
+class ThreadPool;
+
+// what the renderer needs from one finished step. Only one of
+// modelMatrices and instances is filled, depending on the format, and
+// their previous counterpart holds the step before when the simulation
+// keeps it for interpolation
+struct FlockSnapshot {
+	std::vector<glm::mat4> modelMatrices;
+	std::vector<BoidInstance> instances;
+	std::vector<glm::mat4> previousModelMatrices;
+	std::vector<BoidInstance> previousInstances;
+	std::vector<glm::vec3> colors;
+	uint64_t step;
+	// how long the simulation thread took to compute it
+	double stepMs = 0;
+};
+
+// Steps the flock on its own thread so a frame costs max(step, render)
+// instead of step + render. Finished steps are handed over through a
+// lock-free triple buffer: the simulation fills one snapshot, the
+// renderer reads another and the third holds the newest finished step,
+// swapped in and out with a single atomic exchange. The renderer paces
+// the simulation by telling it up to which step to run: one past the
+// step it just picked up keeps one step per frame, a step clock running
+// on real time steps at a fixed rate whatever the frame rate. A slow
+// step never blocks the renderer, it just redraws the last one.
+class SimulationThread {
+public:
+	~SimulationThread() { stop(); }
+
+	// starts stepping the current flock up to the step after it, call
+	// after createBoids. Nothing else may touch the simulation until stop.
+	// keepPrevious also hands over the step before each one
+	void start(InstanceFormat newFormat = INSTANCE_MATRICES, bool keepPrevious = false);
+	void stop();
+	bool running() const { return thread.joinable(); }
+
+	// newest finished step without waiting. Stays valid and unchanged
+	// until the next call
+	const FlockSnapshot& latest();
+	// lets the simulation step on until it has finished step, publishing
+	// every step on the way. Never takes back steps already allowed
+	void runUntil(uint64_t step);
+
+private:
+	void run();
+
+	static const unsigned FreshBit = 4;
+
+	InstanceFormat format = INSTANCE_MATRICES;
+	bool previous = false;
+	FlockSnapshot snapshots[3];
+	int writeSlot = 0;
+	int readSlot = 1;
+	// only the simulation touches it, the renderer never writes that slot
+	int publishedSlot = 2;
+	std::atomic<uint64_t> target{ 0 };
+	// slot index of the newest finished step, plus FreshBit until read
+	std::atomic<unsigned> ready{ 2 };
+
+	std::thread thread;
+	std::atomic<bool> stopping{ false };
+	// only to wake the simulation once it may step further, snapshots
+	// themselves never wait on it
+	std::mutex wakeMutex;
+	std::condition_variable wake;
+};
+
+// Blends the snapshot's previous and current step into out, alpha 0 being
+// the previous step and 1 the current one. Positions and headings blend
+// linearly, the vertex shader normalizes the heading. Matrices only have
+// their translation blended and keep the current rotation
+void interpolateInstances(const FlockSnapshot& snapshot, float alpha, ThreadPool& pool, BoidInstance* out);
+void interpolateModelMatrices(const FlockSnapshot& snapshot, float alpha, ThreadPool& pool, glm::mat4* out);
+
+#endif
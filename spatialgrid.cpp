@@ -0,0 +1,34 @@
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "spatialgrid.hpp"
+
+void SpatialGrid::build(const float* x, const float* y, const float* z, size_t count, float newCellSize) {
+	inverseCellSize = 1.0f / newCellSize;
+
+	// keep the table at least twice the point count so most slots hold one cell
+	unsigned int tableSize = 64;
+	while (tableSize < 2 * count) tableSize <<= 1;
+	tableMask = tableSize - 1;
+
+	cellStart.assign(tableSize + 1, 0);
+	sortedIndices.resize(count);
+	pointSlots.resize(count);
+
+	// count points per slot
+	for (size_t i = 0; i < count; i++) {
+		unsigned int slot = cellHash(cellCoord(x[i]), cellCoord(y[i]), cellCoord(z[i]));
+		pointSlots[i] = slot;
+		cellStart[slot + 1]++;
+	}
+	// prefix sum into start offsets
+	for (unsigned int s = 0; s < tableSize; s++) {
+		cellStart[s + 1] += cellStart[s];
+	}
+	// scatter, reusing the counts as a running cursor per slot
+	slotCursor.assign(cellStart.begin(), cellStart.end() - 1);
+	for (size_t i = 0; i < count; i++) {
+		sortedIndices[slotCursor[pointSlots[i]]++] = (int)i;
+	}
+}
@@ -0,0 +1,82 @@
+#ifndef SPATIALGRID_HPP
+#define SPATIALGRID_HPP
+
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "flock.hpp"
+
+// half open run of entries in an index list
+struct CandidateRange {
+	int begin;
+	int end;
+};
+
+// Uniform grid of cubic cells hashed into a fixed size table, so the
+// flock can roam anywhere without a bounding box. Points are counting
+// sorted by cell on every build; a query only visits the 27 cells
+// around a position.
+class SpatialGrid {
+public:
+	void build(const float* x, const float* y, const float* z, size_t count, float newCellSize);
+
+	// collects the index runs of the 3x3x3 block of cells around pos,
+	// returns how many were written (at most 27). Points further than
+	// cellSize away may be included, callers still have to check distances
+	int candidateRanges(glm::vec3 pos, CandidateRange* ranges) const {
+		if (cellStart.empty()) return 0;
+
+		int cx = cellCoord(pos.x);
+		int cy = cellCoord(pos.y);
+		int cz = cellCoord(pos.z);
+
+		// distinct cells can share a hash slot, only report each slot once
+		unsigned int visited[27];
+		int nVisited = 0;
+		int nRanges = 0;
+
+		for (int dz = -1; dz <= 1; dz++) {
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					unsigned int slot = cellHash(cx + dx, cy + dy, cz + dz);
+					bool seen = false;
+					for (int k = 0; k < nVisited; k++) {
+						if (visited[k] == slot) { seen = true; break; }
+					}
+					if (seen) continue;
+					visited[nVisited++] = slot;
+
+					if (cellStart[slot] == cellStart[slot + 1]) continue;
+					ranges[nRanges].begin = (int)cellStart[slot];
+					ranges[nRanges].end = (int)cellStart[slot + 1];
+					nRanges++;
+				}
+			}
+		}
+		return nRanges;
+	}
+
+	// point ids sorted by slot, the ranges above index into this
+	const int* indices() const { return sortedIndices.data(); }
+
+private:
+	int cellCoord(float v) const {
+		return (int)std::floor(v * inverseCellSize);
+	}
+	unsigned int cellHash(int x, int y, int z) const {
+		// large primes from Teschner et al. 2003
+		return ((unsigned int)x * 73856093u ^ (unsigned int)y * 19349663u ^ (unsigned int)z * 83492791u) & tableMask;
+	}
+
+	float inverseCellSize = 1.0f;
+	unsigned int tableMask = 0;
+	// prefix sums of slot occupancy, slot s owns sortedIndices[cellStart[s], cellStart[s + 1])
+	std::vector<unsigned int> cellStart;
+	AlignedVector<int> sortedIndices;
+	std::vector<unsigned int> pointSlots;
+	std::vector<unsigned int> slotCursor;
+};
+
+#endif
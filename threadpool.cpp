@@ -0,0 +1,130 @@
+#include <algorithm>
+
+#include "threadpool.hpp"
+#include "trace.hpp"
+
+static unsigned long long packRun(unsigned int begin, unsigned int end) {
+	return ((unsigned long long)end << 32) | begin;
+}
+static unsigned int runBegin(unsigned long long run) { return (unsigned int)run; }
+static unsigned int runEnd(unsigned long long run) { return (unsigned int)(run >> 32); }
+
+ThreadPool::ThreadPool(int threads) {
+	if (threads <= 0) threads = (int)std::thread::hardware_concurrency();
+	nThreads = std::max(threads, 1);
+	runs.reset(new ChunkRun[nThreads]);
+	for (int w = 0; w < nThreads; w++) {
+		runs[w].run.store(0);
+	}
+	// slot 0 belongs to whoever calls parallelFor
+	for (int w = 1; w < nThreads; w++) {
+		workers.push_back(std::thread(&ThreadPool::workerLoop, this, w));
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+void ThreadPool::parallelFor(int newCount, int newChunkSize, const std::function<void(int, int)>& newBody) {
+	if (newCount <= 0) return;
+	newChunkSize = std::max(newChunkSize, 1);
+	int nChunks = (newCount + newChunkSize - 1) / newChunkSize;
+
+	if (nThreads == 1 || nChunks == 1) {
+		newBody(0, newCount);
+		return;
+	}
+
+	body = &newBody;
+	count = newCount;
+	chunkSize = newChunkSize;
+	// deal contiguous runs of chunks out evenly
+	for (int w = 0; w < nThreads; w++) {
+		unsigned int begin = (unsigned int)((long long)nChunks * w / nThreads);
+		unsigned int end = (unsigned int)((long long)nChunks * (w + 1) / nThreads);
+		runs[w].run.store(packRun(begin, end));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		generation++;
+		busyWorkers = nThreads - 1;
+	}
+	wake.notify_all();
+
+	runChunks(0);
+
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this] { return busyWorkers == 0; });
+	body = nullptr;
+}
+
+void ThreadPool::workerLoop(int worker) {
+	TRACE_THREAD_NAME("pool worker");
+	unsigned int seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			wake.wait(lock, [&] { return stopping || generation != seen; });
+			if (stopping) return;
+			seen = generation;
+		}
+
+		runChunks(worker);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (--busyWorkers == 0) done.notify_one();
+	}
+}
+
+void ThreadPool::runChunks(int worker) {
+	int chunk;
+	while (popChunk(worker, chunk) || stealChunks(worker, chunk)) {
+		int begin = chunk * chunkSize;
+		int end = std::min(begin + chunkSize, count);
+		(*body)(begin, end);
+	}
+}
+
+// owner takes chunks off the front of its run
+bool ThreadPool::popChunk(int worker, int& chunk) {
+	std::atomic<unsigned long long>& slot = runs[worker].run;
+	unsigned long long run = slot.load();
+	while (runBegin(run) < runEnd(run)) {
+		if (slot.compare_exchange_weak(run, packRun(runBegin(run) + 1, runEnd(run)))) {
+			chunk = (int)runBegin(run);
+			return true;
+		}
+	}
+	return false;
+}
+
+// thieves take the back half of someone else's run and keep it as their own.
+// Once no run has chunks left the loop is finished apart from chunks
+// already claimed, so returning false is safe
+bool ThreadPool::stealChunks(int thief, int& chunk) {
+	for (int k = 1; k < nThreads; k++) {
+		int victim = (thief + k) % nThreads;
+		std::atomic<unsigned long long>& slot = runs[victim].run;
+		unsigned long long run = slot.load();
+		while (runBegin(run) < runEnd(run)) {
+			unsigned int begin = runBegin(run);
+			unsigned int end = runEnd(run);
+			unsigned int split = end - (end - begin + 1) / 2;
+			if (slot.compare_exchange_weak(run, packRun(begin, split))) {
+				chunk = (int)split;
+				runs[thief].run.store(packRun(split + 1, end));
+				return true;
+			}
+		}
+	}
+	return false;
+}
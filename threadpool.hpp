@@ -0,0 +1,59 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads running chunked parallel loops. Each loop
+// deals its chunks out evenly up front; a thread that runs dry steals
+// half of the remaining chunks from the back of another thread's run,
+// so uneven per boid costs still keep every core busy.
+class ThreadPool {
+public:
+	// nThreads counts the calling thread too, 0 means one per core
+	explicit ThreadPool(int nThreads);
+	~ThreadPool();
+
+	int size() const { return nThreads; }
+
+	// calls body(begin, end) over [0, count) in runs of at most chunkSize,
+	// returns once every chunk is done. The calling thread joins in
+	void parallelFor(int count, int chunkSize, const std::function<void(int, int)>& body);
+
+private:
+	// [begin, end) of chunk indices packed into one word so owner pops
+	// and steals both go through a single compare and swap. Padded so
+	// neighboring runs never share a cache line
+	struct ChunkRun {
+		std::atomic<unsigned long long> run;
+		char padding[64 - sizeof(std::atomic<unsigned long long>)];
+	};
+
+	void workerLoop(int worker);
+	void runChunks(int worker);
+	bool popChunk(int worker, int& chunk);
+	bool stealChunks(int thief, int& chunk);
+
+	int nThreads;
+	std::vector<std::thread> workers;
+	std::unique_ptr<ChunkRun[]> runs;
+
+	// current loop
+	const std::function<void(int, int)>* body = nullptr;
+	int count = 0;
+	int chunkSize = 1;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	unsigned int generation = 0;
+	int busyWorkers = 0;
+	bool stopping = false;
+};
+
+#endif
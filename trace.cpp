@@ -0,0 +1,113 @@
+#include <cstdio>
+
+#include "trace.hpp"
+
+#ifdef BOIDS_TRACE
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+struct TraceEvent {
+	const char* name;
+	uint64_t start;
+	uint64_t end;
+};
+
+// Written only by its thread. count goes up once an event is complete,
+// so the writer of the file sees whole events up to it
+struct TraceRing {
+	std::unique_ptr<TraceEvent[]> events{ new TraceEvent[TraceEventsPerThread] };
+	std::atomic<uint64_t> count{ 0 };
+	std::string threadName;
+	int id = 0;
+};
+
+// Rings outlive their threads, so pool workers that already exited still
+// show up. The mutex only guards the list, taken once per thread
+static std::mutex RingsMutex;
+static std::vector<std::unique_ptr<TraceRing>> Rings;
+static thread_local TraceRing* ThreadRing = nullptr;
+
+static TraceRing* threadRing() {
+	if (ThreadRing == nullptr) {
+		std::lock_guard<std::mutex> lock(RingsMutex);
+		Rings.push_back(std::unique_ptr<TraceRing>(new TraceRing()));
+		ThreadRing = Rings.back().get();
+		ThreadRing->id = (int)Rings.size();
+	}
+	return ThreadRing;
+}
+
+uint64_t traceNow() {
+	return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void traceRecord(const char* name, uint64_t startNs, uint64_t endNs) {
+	TraceRing* ring = threadRing();
+	uint64_t n = ring->count.load(std::memory_order_relaxed);
+	TraceEvent& event = ring->events[n % TraceEventsPerThread];
+	event.name = name;
+	event.start = startNs;
+	event.end = endNs;
+	ring->count.store(n + 1, std::memory_order_release);
+}
+
+void setTraceThreadName(const char* name) {
+	TraceRing* ring = threadRing();
+	std::lock_guard<std::mutex> lock(RingsMutex);
+	ring->threadName = name;
+}
+
+bool writeTrace(const char* path) {
+	FILE* out = fopen(path, "w");
+	if (out == NULL) return false;
+
+	std::lock_guard<std::mutex> lock(RingsMutex);
+	// timestamps relative to the earliest start keep the numbers short.
+	// Scopes are stored when they end, so an outer scope comes after the
+	// ones inside it and every kept event has to be looked at
+	uint64_t origin = UINT64_MAX;
+	for (size_t r = 0; r < Rings.size(); r++) {
+		uint64_t count = Rings[r]->count.load(std::memory_order_acquire);
+		uint64_t first = count > (uint64_t)TraceEventsPerThread ? count - TraceEventsPerThread : 0;
+		for (uint64_t i = first; i < count; i++) {
+			origin = std::min(origin, Rings[r]->events[i % TraceEventsPerThread].start);
+		}
+	}
+
+	// complete ("X") events in microseconds, plus the thread names
+	fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	bool firstEvent = true;
+	for (size_t r = 0; r < Rings.size(); r++) {
+		const TraceRing& ring = *Rings[r];
+		if (!ring.threadName.empty()) {
+			fprintf(out, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}",
+				firstEvent ? "" : ",\n", ring.id, ring.threadName.c_str());
+			firstEvent = false;
+		}
+		uint64_t count = ring.count.load(std::memory_order_acquire);
+		uint64_t first = count > (uint64_t)TraceEventsPerThread ? count - TraceEventsPerThread : 0;
+		for (uint64_t i = first; i < count; i++) {
+			const TraceEvent& event = ring.events[i % TraceEventsPerThread];
+			fprintf(out, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+				firstEvent ? "" : ",\n", event.name, ring.id, (event.start - origin) * 1e-3, (event.end - event.start) * 1e-3);
+			firstEvent = false;
+		}
+	}
+	fprintf(out, "\n]}\n");
+	return fclose(out) == 0;
+}
+
+#else
+
+bool writeTrace(const char* path) {
+	(void)path;
+	return false;
+}
+
+#endif
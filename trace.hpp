@@ -0,0 +1,55 @@
+#ifndef TRACE_HPP
+#define TRACE_HPP
+
+// Scoped timing markers written out in Chrome's trace event format, to
+// open in ui.perfetto.dev or chrome://tracing. Compiled out unless
+// BOIDS_TRACE is defined, so the markers cost nothing in normal builds.
+//
+// Every thread records into its own ring buffer, so recording takes no
+// lock and never waits on another thread. A ring keeps its thread's
+// newest TraceEventsPerThread scopes, older ones are overwritten. Names
+// must outlive the program, string literals in practice.
+
+#ifdef BOIDS_TRACE
+
+#include <cstdint>
+
+const int TraceEventsPerThread = 1 << 18;
+
+// nanoseconds on the steady clock
+uint64_t traceNow();
+void traceRecord(const char* name, uint64_t startNs, uint64_t endNs);
+// shown as the calling thread's name in the viewer
+void setTraceThreadName(const char* name);
+
+class TraceScope {
+public:
+	explicit TraceScope(const char* name) : name(name), start(traceNow()) {}
+	~TraceScope() { traceRecord(name, start, traceNow()); }
+	TraceScope(const TraceScope&) = delete;
+	TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+	const char* name;
+	uint64_t start;
+};
+
+#define TRACE_JOIN2(a, b) a##b
+#define TRACE_JOIN(a, b) TRACE_JOIN2(a, b)
+// times the rest of the enclosing block
+#define TRACE_SCOPE(name) TraceScope TRACE_JOIN(traceScope, __LINE__)(name)
+#define TRACE_THREAD_NAME(name) setTraceThreadName(name)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+#endif
+
+// Writes every thread's recorded scopes as trace event JSON. Threads
+// still recording may tear their oldest events, so call it once the
+// simulation is stopped. False on I/O errors or without BOIDS_TRACE
+bool writeTrace(const char* path);
+
+#endif
@@ -0,0 +1,543 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+
+#include "trajectory.hpp"
+#include "boids.hpp"
+#include "threadpool.hpp"
+
+// File layout: this header, one record per recorded step, then the index
+// (a TrajectoryIndexEntry per record) and the footer. Everything is
+// little endian, as written by the x86 and ARM machines this runs on
+struct TrajectoryHeader {
+	char magic[4];				// "BTRJ"
+	uint32_t version;			// TrajectoryVersion
+	uint32_t boidCount;
+	uint32_t blockSize;			// boids per block
+	uint32_t keyframeInterval;
+	uint32_t reserved[3];
+};
+
+// A record is this header, for keyframes the bounding box (6 floats),
+// the byte size of every block, then the blocks. A keyframe block holds
+// its boids' quantized values at full width, one stream (position x, y,
+// z, velocity x, y, z, color r, g, b) after the other. Other blocks hold
+// the zigzag varint change of each value since the last record, in the
+// same order
+struct TrajectoryRecordHeader {
+	char magic[4];				// "STEP"
+	uint32_t keyframe;
+	uint64_t step;
+	uint64_t bytes;				// after this header
+};
+
+struct TrajectoryFooter {
+	char magic[4];				// "BIDX"
+	uint32_t reserved;
+	uint64_t indexOffset;
+	uint64_t records;
+};
+
+static const char HeaderMagic[4] = { 'B', 'T', 'R', 'J' };
+static const char RecordMagic[4] = { 'S', 'T', 'E', 'P' };
+static const char FooterMagic[4] = { 'B', 'I', 'D', 'X' };
+
+static const float PositionLevels = 65535.0f;
+static const float VelocityLevels = 65535.0f;
+static const float ColorLevels = 255.0f;
+
+void TrajectoryFrame::resize(size_t n) {
+	for (int axis = 0; axis < 3; axis++) {
+		position[axis].resize(n);
+		velocity[axis].resize(n);
+		color[axis].resize(n);
+	}
+}
+
+static int blockCount(uint32_t boids, uint32_t blockSize) {
+	return (int)((boids + blockSize - 1) / blockSize);
+}
+
+static uint32_t zigzag(int32_t value) {
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t unzigzag(uint32_t value) {
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+template <typename T>
+static uint8_t* encodeDeltas(uint8_t* out, const T* values, const T* previous, int n) {
+	for (int i = 0; i < n; i++) {
+		uint32_t delta = zigzag((int32_t)values[i] - (int32_t)previous[i]);
+		while (delta >= 0x80) {
+			*out++ = (uint8_t)(delta | 0x80);
+			delta >>= 7;
+		}
+		*out++ = (uint8_t)delta;
+	}
+	return out;
+}
+
+// NULL if the data runs out or is malformed
+template <typename T>
+static const uint8_t* decodeDeltas(const uint8_t* in, const uint8_t* end, T* values, int n) {
+	for (int i = 0; i < n; i++) {
+		uint32_t delta = 0;
+		for (int shift = 0; ; shift += 7) {
+			if (in == end || shift > 14) return NULL;
+			uint8_t byte = *in++;
+			delta |= (uint32_t)(byte & 0x7f) << shift;
+			if (!(byte & 0x80)) break;
+		}
+		values[i] = (T)(values[i] + unzigzag(delta));
+	}
+	return in;
+}
+
+template <typename T>
+static uint8_t* copyOut(uint8_t* out, const T* values, int n) {
+	memcpy(out, values, n * sizeof(T));
+	return out + n * sizeof(T);
+}
+
+template <typename T>
+static const uint8_t* copyIn(const uint8_t* in, const uint8_t* end, T* values, int n) {
+	if ((size_t)(end - in) < n * sizeof(T)) return NULL;
+	memcpy(values, in, n * sizeof(T));
+	return in + n * sizeof(T);
+}
+
+// boids [begin, end) of frame, whole for a keyframe or else as the change
+// since previous
+static uint8_t* encodeBlock(uint8_t* out, const TrajectoryFrame& frame, const TrajectoryFrame& previous, bool keyframe, int begin, int end) {
+	int n = end - begin;
+	for (int axis = 0; axis < 3; axis++) {
+		if (keyframe) out = copyOut(out, frame.position[axis].data() + begin, n);
+		else out = encodeDeltas(out, frame.position[axis].data() + begin, previous.position[axis].data() + begin, n);
+	}
+	for (int axis = 0; axis < 3; axis++) {
+		if (keyframe) out = copyOut(out, frame.velocity[axis].data() + begin, n);
+		else out = encodeDeltas(out, frame.velocity[axis].data() + begin, previous.velocity[axis].data() + begin, n);
+	}
+	for (int axis = 0; axis < 3; axis++) {
+		if (keyframe) out = copyOut(out, frame.color[axis].data() + begin, n);
+		else out = encodeDeltas(out, frame.color[axis].data() + begin, previous.color[axis].data() + begin, n);
+	}
+	return out;
+}
+
+// applies one record's block to frame in place, false on bad data
+static bool decodeBlock(const uint8_t* in, const uint8_t* dataEnd, TrajectoryFrame& frame, bool keyframe, int begin, int end) {
+	int n = end - begin;
+	for (int axis = 0; axis < 3 && in; axis++) {
+		if (keyframe) in = copyIn(in, dataEnd, frame.position[axis].data() + begin, n);
+		else in = decodeDeltas(in, dataEnd, frame.position[axis].data() + begin, n);
+	}
+	for (int axis = 0; axis < 3 && in; axis++) {
+		if (keyframe) in = copyIn(in, dataEnd, frame.velocity[axis].data() + begin, n);
+		else in = decodeDeltas(in, dataEnd, frame.velocity[axis].data() + begin, n);
+	}
+	for (int axis = 0; axis < 3 && in; axis++) {
+		if (keyframe) in = copyIn(in, dataEnd, frame.color[axis].data() + begin, n);
+		else in = decodeDeltas(in, dataEnd, frame.color[axis].data() + begin, n);
+	}
+	return in == dataEnd;
+}
+
+// true if every position and velocity of boids [begin, end) is finite
+static bool finiteBlock(const FlockState& state, int begin, int end) {
+	const float* streams[6] = { state.px.data(), state.py.data(), state.pz.data(), state.vx.data(), state.vy.data(), state.vz.data() };
+	for (int s = 0; s < 6; s++) {
+		for (int i = begin; i < end; i++) {
+			if (!std::isfinite(streams[s][i])) return false;
+		}
+	}
+	return true;
+}
+
+// quantizes boids [begin, end) of state into frame against frame's box,
+// false if any of them lies outside it
+static bool quantizeBlock(const FlockState& state, TrajectoryFrame& frame, int begin, int end) {
+	const float* positions[3] = { state.px.data(), state.py.data(), state.pz.data() };
+	const float* velocities[3] = { state.vx.data(), state.vy.data(), state.vz.data() };
+	bool inside = true;
+	for (int axis = 0; axis < 3; axis++) {
+		float low = frame.boxMin[axis];
+		float high = frame.boxMax[axis];
+		float scale = high > low ? PositionLevels / (high - low) : 0.0f;
+		uint16_t* quantized = frame.position[axis].data();
+		for (int i = begin; i < end; i++) {
+			float p = positions[axis][i];
+			if (p < low || p > high) {
+				inside = false;
+				p = p < low ? low : high;
+			}
+			quantized[i] = (uint16_t)std::min((p - low) * scale + 0.5f, PositionLevels);
+		}
+	}
+	for (int axis = 0; axis < 3; axis++) {
+		uint16_t* quantized = frame.velocity[axis].data();
+		for (int i = begin; i < end; i++) {
+			float v = velocities[axis][i];
+			if (!(v >= -1.0f)) v = -1.0f;
+			else if (v > 1.0f) v = 1.0f;
+			quantized[i] = (uint16_t)((v + 1) * (VelocityLevels / 2) + 0.5f);
+		}
+	}
+	for (int i = begin; i < end; i++) {
+		glm::vec3 color = glm::clamp(state.colors[i], 0.0f, 1.0f);
+		for (int axis = 0; axis < 3; axis++) {
+			frame.color[axis][i] = (uint8_t)(color[axis] * ColorLevels + 0.5f);
+		}
+	}
+	return inside;
+}
+
+static void dequantizeBlock(const TrajectoryFrame& frame, FlockState& state, int begin, int end) {
+	float* positions[3] = { state.px.data(), state.py.data(), state.pz.data() };
+	float* velocities[3] = { state.vx.data(), state.vy.data(), state.vz.data() };
+	for (int axis = 0; axis < 3; axis++) {
+		float low = frame.boxMin[axis];
+		float step = (frame.boxMax[axis] - low) / PositionLevels;
+		const uint16_t* position = frame.position[axis].data();
+		const uint16_t* velocity = frame.velocity[axis].data();
+		for (int i = begin; i < end; i++) {
+			positions[axis][i] = low + position[i] * step;
+			velocities[axis][i] = velocity[i] * (2 / VelocityLevels) - 1;
+		}
+	}
+	for (int i = begin; i < end; i++) {
+		state.colors[i] = glm::vec3(frame.color[0][i], frame.color[1][i], frame.color[2][i]) / ColorLevels;
+	}
+}
+
+TrajectoryRecorder::TrajectoryRecorder() {}
+
+TrajectoryRecorder::~TrajectoryRecorder() {
+	close();
+}
+
+bool TrajectoryRecorder::open(const char* path, int keyframeInterval, int nThreads) {
+	close();
+	file = fopen(path, "wb");
+	if (file == NULL) return false;
+	failed = false;
+	offset = 0;
+	interval = std::max(keyframeInterval, 1);
+	sinceKeyframe = 0;
+	boidCount = 0;
+	index.clear();
+	if (!pool || pool->size() != nThreads) pool.reset(new ThreadPool(nThreads));
+	return true;
+}
+
+bool TrajectoryRecorder::write(const void* data, size_t bytes) {
+	if (failed) return false;
+	if (bytes > 0 && fwrite(data, bytes, 1, file) != 1) failed = true;
+	offset += bytes;
+	return !failed;
+}
+
+bool TrajectoryRecorder::record(const FlockState& state, uint64_t step) {
+	if (file == NULL || failed) return false;
+
+	// no box holds a NaN or an infinity, such a state is refused whole
+	std::atomic<bool> finite(true);
+	pool->parallelFor(blockCount((uint32_t)state.size(), TrajectoryBlock), 1, [&](int first, int last) {
+		for (int b = first; b < last; b++) {
+			int end = std::min((b + 1) * TrajectoryBlock, (int)state.size());
+			if (!finiteBlock(state, b * TrajectoryBlock, end)) finite = false;
+		}
+	});
+	if (!finite) return false;
+
+	// the boid count is only known once the first state comes in
+	if (offset == 0) {
+		TrajectoryHeader header = {};
+		memcpy(header.magic, HeaderMagic, 4);
+		header.version = TrajectoryVersion;
+		header.boidCount = (uint32_t)state.size();
+		header.blockSize = TrajectoryBlock;
+		header.keyframeInterval = interval;
+		boidCount = header.boidCount;
+		previous.resize(boidCount);
+		current.resize(boidCount);
+		blocks.resize(blockCount(boidCount, TrajectoryBlock));
+		if (!write(&header, sizeof(header))) return false;
+	}
+	if (state.size() != boidCount) {
+		failed = true;
+		return false;
+	}
+
+	int nBlocks = (int)blocks.size();
+	bool keyframe = sinceKeyframe == 0;
+	if (!keyframe) {
+		memcpy(current.boxMin, previous.boxMin, sizeof(current.boxMin));
+		memcpy(current.boxMax, previous.boxMax, sizeof(current.boxMax));
+		// a boid that left the keyframe's box starts a new keyframe early
+		std::atomic<bool> outside(false);
+		pool->parallelFor(nBlocks, 1, [&](int first, int last) {
+			for (int b = first; b < last; b++) {
+				int end = std::min((b + 1) * TrajectoryBlock, (int)boidCount);
+				if (!quantizeBlock(state, current, b * TrajectoryBlock, end)) outside = true;
+			}
+		});
+		keyframe = outside;
+	}
+	if (keyframe) {
+		std::vector<float> boxes(nBlocks * 6);
+		pool->parallelFor(nBlocks, 1, [&](int first, int last) {
+			for (int b = first; b < last; b++) {
+				int end = std::min((b + 1) * TrajectoryBlock, (int)boidCount);
+				const float* positions[3] = { state.px.data(), state.py.data(), state.pz.data() };
+				for (int axis = 0; axis < 3; axis++) {
+					float low = INFINITY, high = -INFINITY;
+					for (int i = b * TrajectoryBlock; i < end; i++) {
+						low = std::min(low, positions[axis][i]);
+						high = std::max(high, positions[axis][i]);
+					}
+					boxes[b * 6 + axis] = low;
+					boxes[b * 6 + 3 + axis] = high;
+				}
+			}
+		});
+		// boids move at unit speed, pad so they stay inside until the
+		// next keyframe
+		float pad = interval * std::fabs(getBoidParams().dt) + 1e-3f;
+		for (int axis = 0; axis < 3; axis++) {
+			float low = INFINITY, high = -INFINITY;
+			for (int b = 0; b < nBlocks; b++) {
+				low = std::min(low, boxes[b * 6 + axis]);
+				high = std::max(high, boxes[b * 6 + 3 + axis]);
+			}
+			if (nBlocks == 0) low = high = 0;
+			current.boxMin[axis] = low - pad;
+			current.boxMax[axis] = high + pad;
+		}
+		pool->parallelFor(nBlocks, 1, [&](int first, int last) {
+			for (int b = first; b < last; b++) {
+				int end = std::min((b + 1) * TrajectoryBlock, (int)boidCount);
+				quantizeBlock(state, current, b * TrajectoryBlock, end);
+			}
+		});
+	}
+
+	std::vector<uint32_t> blockBytes(nBlocks);
+	pool->parallelFor(nBlocks, 1, [&](int first, int last) {
+		for (int b = first; b < last; b++) {
+			int begin = b * TrajectoryBlock;
+			int end = std::min(begin + TrajectoryBlock, (int)boidCount);
+			// a varint of a 16 bit change takes at most 3 bytes
+			std::vector<uint8_t>& block = blocks[b];
+			block.resize((size_t)(end - begin) * 9 * 3);
+			uint8_t* used = encodeBlock(block.data(), current, previous, keyframe, begin, end);
+			block.resize(used - block.data());
+			blockBytes[b] = (uint32_t)block.size();
+		}
+	});
+
+	TrajectoryRecordHeader header = {};
+	memcpy(header.magic, RecordMagic, 4);
+	header.keyframe = keyframe ? 1 : 0;
+	header.step = step;
+	header.bytes = (keyframe ? 6 * sizeof(float) : 0) + nBlocks * sizeof(uint32_t);
+	for (int b = 0; b < nBlocks; b++) header.bytes += blockBytes[b];
+
+	TrajectoryIndexEntry entry = { step, offset };
+	write(&header, sizeof(header));
+	if (keyframe) {
+		write(current.boxMin, sizeof(current.boxMin));
+		write(current.boxMax, sizeof(current.boxMax));
+	}
+	write(blockBytes.data(), blockBytes.size() * sizeof(uint32_t));
+	for (int b = 0; b < nBlocks; b++) write(blocks[b].data(), blocks[b].size());
+	if (failed) return false;
+	index.push_back(entry);
+
+	std::swap(previous, current);
+	sinceKeyframe = keyframe ? 1 : sinceKeyframe + 1;
+	if (sinceKeyframe >= interval) sinceKeyframe = 0;
+	return true;
+}
+
+bool TrajectoryRecorder::close() {
+	if (file == NULL) return true;
+	if (offset == 0) {
+		// nothing recorded, still leave a valid empty file
+		TrajectoryHeader header = {};
+		memcpy(header.magic, HeaderMagic, 4);
+		header.version = TrajectoryVersion;
+		header.blockSize = TrajectoryBlock;
+		header.keyframeInterval = interval;
+		write(&header, sizeof(header));
+	}
+	TrajectoryFooter footer = {};
+	memcpy(footer.magic, FooterMagic, 4);
+	footer.indexOffset = offset;
+	footer.records = index.size();
+	write(index.data(), index.size() * sizeof(TrajectoryIndexEntry));
+	write(&footer, sizeof(footer));
+	bool written = fclose(file) == 0 && !failed;
+	file = NULL;
+	failed = false;
+	return written;
+}
+
+TrajectoryReader::TrajectoryReader() {}
+
+TrajectoryReader::~TrajectoryReader() {}
+
+void TrajectoryReader::close() {
+	file.close();
+	boidCount = 0;
+	index.clear();
+	keyframes.clear();
+	current = -1;
+}
+
+bool TrajectoryReader::open(const char* path, int nThreads) {
+	close();
+	if (!file.open(path)) return false;
+
+	TrajectoryHeader header;
+	size_t size = file.size();
+	bool valid = size >= sizeof(header);
+	if (valid) {
+		memcpy(&header, file.data(), sizeof(header));
+		valid = memcmp(header.magic, HeaderMagic, 4) == 0 &&
+			header.version == TrajectoryVersion &&
+			header.blockSize > 0;
+	}
+	if (!valid) {
+		close();
+		return false;
+	}
+	boidCount = header.boidCount;
+	blockSize = header.blockSize;
+
+	// a record must lie whole inside the file
+	auto readRecord = [&](uint64_t at, TrajectoryRecordHeader& record) {
+		if (at < sizeof(header) || at > size || size - at < sizeof(record)) return false;
+		memcpy(&record, file.data() + at, sizeof(record));
+		return memcmp(record.magic, RecordMagic, 4) == 0 && record.bytes <= size - at - sizeof(record);
+	};
+
+	TrajectoryFooter footer;
+	bool indexed = size >= sizeof(header) + sizeof(footer);
+	if (indexed) {
+		memcpy(&footer, file.data() + size - sizeof(footer), sizeof(footer));
+		indexed = memcmp(footer.magic, FooterMagic, 4) == 0 &&
+			footer.indexOffset <= size - sizeof(footer) &&
+			footer.records == (size - sizeof(footer) - footer.indexOffset) / sizeof(TrajectoryIndexEntry);
+	}
+	if (indexed) {
+		index.resize((size_t)footer.records);
+		memcpy(index.data(), file.data() + footer.indexOffset, index.size() * sizeof(TrajectoryIndexEntry));
+		for (size_t r = 0; r < index.size() && indexed; r++) {
+			TrajectoryRecordHeader record;
+			indexed = readRecord(index[r].offset, record) && record.step == index[r].step &&
+				(r == 0 || index[r].step > index[r - 1].step);
+			keyframes.push_back(record.keyframe != 0);
+		}
+	}
+	if (!indexed) {
+		// no usable index, walk the records up to the first incomplete one
+		index.clear();
+		keyframes.clear();
+		uint64_t at = sizeof(header);
+		TrajectoryRecordHeader record;
+		while (readRecord(at, record) && (index.empty() || record.step > index.back().step)) {
+			TrajectoryIndexEntry entry = { record.step, at };
+			index.push_back(entry);
+			keyframes.push_back(record.keyframe != 0);
+			at += sizeof(record) + record.bytes;
+		}
+	}
+
+	frame.resize(boidCount);
+	if (!pool || pool->size() != nThreads) pool.reset(new ThreadPool(nThreads));
+	return true;
+}
+
+bool TrajectoryReader::seek(uint64_t step, FlockState& state, uint64_t* decoded) {
+	TrajectoryIndexEntry key = { step, 0 };
+	auto after = std::upper_bound(index.begin(), index.end(), key,
+		[](const TrajectoryIndexEntry& a, const TrajectoryIndexEntry& b) { return a.step < b.step; });
+	if (after == index.begin()) return false;
+	size_t record = (after - index.begin()) - 1;
+	if (!decodeTo(record, state)) return false;
+	if (decoded) *decoded = index[record].step;
+	return true;
+}
+
+bool TrajectoryReader::next(FlockState& state, uint64_t* decoded) {
+	size_t record = (size_t)(current + 1);
+	if (record >= index.size()) return false;
+	if (!decodeTo(record, state)) return false;
+	if (decoded) *decoded = index[record].step;
+	return true;
+}
+
+bool TrajectoryReader::decodeTo(size_t record, FlockState& state) {
+	size_t start = record;
+	while (!keyframes[start]) {
+		if (start == 0) return false;
+		start--;
+	}
+	// carry on from the record in frame when no keyframe lies in between
+	if (current >= (long long)start && current <= (long long)record) start = (size_t)current + 1;
+
+	// where every block of every record to apply starts, plus its end
+	int nBlocks = blockCount(boidCount, blockSize);
+	std::vector<const uint8_t*> blockStarts;
+	blockStarts.reserve((record + 1 - std::min(start, record + 1)) * (nBlocks + 1));
+	for (size_t r = start; r <= record; r++) {
+		TrajectoryRecordHeader header;
+		const uint8_t* at = (const uint8_t*)file.data() + index[r].offset;
+		memcpy(&header, at, sizeof(header));
+		const uint8_t* end = at + sizeof(header) + header.bytes;
+		at += sizeof(header);
+		if (header.keyframe) {
+			if ((size_t)(end - at) < 6 * sizeof(float)) return false;
+			memcpy(frame.boxMin, at, sizeof(frame.boxMin));
+			memcpy(frame.boxMax, at + sizeof(frame.boxMin), sizeof(frame.boxMax));
+			at += 6 * sizeof(float);
+		}
+		if ((size_t)(end - at) < nBlocks * sizeof(uint32_t)) return false;
+		const uint8_t* data = at + nBlocks * sizeof(uint32_t);
+		for (int b = 0; b < nBlocks; b++) {
+			uint32_t bytes;
+			memcpy(&bytes, at + b * sizeof(uint32_t), sizeof(bytes));
+			blockStarts.push_back(data);
+			if ((size_t)(end - data) < bytes) return false;
+			data += bytes;
+		}
+		blockStarts.push_back(data);
+		if (data != end) return false;
+	}
+
+	// frame is changed from here on, only valid if every block decodes
+	current = -1;
+	state.resize(boidCount);
+	std::atomic<bool> valid(true);
+	pool->parallelFor(nBlocks, 1, [&](int first, int last) {
+		for (int b = first; b < last; b++) {
+			int begin = b * (int)blockSize;
+			int end = (int)std::min((uint64_t)(b + 1) * blockSize, (uint64_t)boidCount);
+			for (size_t r = start; r <= record; r++) {
+				const uint8_t* const* starts = &blockStarts[(r - start) * (nBlocks + 1)];
+				if (!decodeBlock(starts[b], starts[b + 1], frame, keyframes[r], begin, end)) {
+					valid = false;
+					return;
+				}
+			}
+			dequantizeBlock(frame, state, begin, end);
+		}
+	});
+	if (!valid) return false;
+	current = (long long)record;
+	return true;
+}
@@ -0,0 +1,117 @@
+#ifndef TRAJECTORY_HPP
+#define TRAJECTORY_HPP
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include "common/mappedfile.hpp"
+#include "flock.hpp"
+
+class ThreadPool;
+
+// bump whenever the layout changes, older recordings are refused
+const uint32_t TrajectoryVersion = 1;
+// boids per independently coded block, blocks encode and decode in parallel
+const int TrajectoryBlock = 16384;
+
+// Quantized flock state of one recorded step, what records are coded
+// against. Positions are 16 bit fractions of the keyframe's bounding
+// box, velocity components 16 bit fractions of [-1, 1] and colors 8 bits
+// a channel (clamped to [0, 1])
+struct TrajectoryFrame {
+	float boxMin[3];
+	float boxMax[3];
+	std::vector<uint16_t> position[3];
+	std::vector<uint16_t> velocity[3];
+	std::vector<uint8_t> color[3];
+
+	void resize(size_t n);
+};
+
+// where each record starts, the seek index at the end of a file
+struct TrajectoryIndexEntry {
+	uint64_t step;
+	uint64_t offset;
+};
+
+// Streams flock states to disk as they are stepped. Every keyframeInterval
+// records the flock is stored whole, quantized against its bounding box
+// padded by how far boids can move (unit speed, dt per step) until the next
+// keyframe. The records in between store only the change of each quantized
+// value as a zigzag varint, one byte for most boids. An index of every
+// record's offset is written at the end, so the replayer can seek
+class TrajectoryRecorder {
+public:
+	TrajectoryRecorder();
+	~TrajectoryRecorder();
+
+	// nThreads encode blocks, 0 = one per core
+	bool open(const char* path, int keyframeInterval = 32, int nThreads = 0);
+	// appends state as step, false on I/O errors. Every record of a file
+	// must have the same number of boids. A state with a position or
+	// velocity that is not finite is refused, false with nothing written
+	bool record(const FlockState& state, uint64_t step);
+	// writes the index, false if anything failed since open
+	bool close();
+
+	bool isOpen() const { return file != NULL; }
+	uint64_t bytesWritten() const { return offset; }
+	uint64_t records() const { return index.size(); }
+
+private:
+	bool write(const void* data, size_t bytes);
+
+	FILE* file = NULL;
+	bool failed = false;
+	uint64_t offset = 0;
+	int interval = 32;
+	int sinceKeyframe = 0;
+	uint32_t boidCount = 0;
+	TrajectoryFrame previous, current;
+	std::vector<std::vector<uint8_t>> blocks;
+	std::vector<TrajectoryIndexEntry> index;
+	std::unique_ptr<ThreadPool> pool;
+};
+
+// Plays a recording back from a memory mapping. Seeking decodes the
+// keyframe at or before the step and then every record up to it, so it
+// costs at most keyframeInterval records whatever the file size. Stepping
+// forward one record only applies its deltas
+class TrajectoryReader {
+public:
+	TrajectoryReader();
+	~TrajectoryReader();
+
+	// a recording cut short without its index, e.g. by a crash, is
+	// indexed by walking its records instead
+	bool open(const char* path, int nThreads = 0);
+	void close();
+
+	size_t records() const { return index.size(); }
+	uint32_t boids() const { return boidCount; }
+	uint64_t firstStep() const { return index.empty() ? 0 : index.front().step; }
+	uint64_t lastStep() const { return index.empty() ? 0 : index.back().step; }
+
+	// decodes the last recorded step at or before step into state,
+	// false if there is none. Returns the record's step in decoded
+	bool seek(uint64_t step, FlockState& state, uint64_t* decoded = NULL);
+	// decodes the record after the last one decoded
+	bool next(FlockState& state, uint64_t* decoded = NULL);
+
+private:
+	bool decodeTo(size_t record, FlockState& state);
+
+	MappedFile file;
+	uint32_t boidCount = 0;
+	uint32_t blockSize = TrajectoryBlock;
+	std::vector<TrajectoryIndexEntry> index;
+	std::vector<bool> keyframes;
+	TrajectoryFrame frame;
+	// record held in frame, -1 if none
+	long long current = -1;
+	std::unique_ptr<ThreadPool> pool;
+};
+
+#endif
@@ -0,0 +1,60 @@
+#include "uploadring.hpp"
+
+bool UploadRing::supported() {
+	return GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+}
+
+bool UploadRing::create(size_t newRegionSize) {
+	destroy();
+	if (!supported() || newRegionSize == 0) return false;
+
+	regionBytes = newRegionSize;
+	// coherent, so writes become visible to the GPU without explicit flushes
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glGenBuffers(1, &bufferID);
+	glBindBuffer(GL_ARRAY_BUFFER, bufferID);
+	glBufferStorage(GL_ARRAY_BUFFER, Regions * regionBytes, NULL, flags);
+	mapped = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, Regions * regionBytes, flags);
+	if (mapped == NULL) {
+		destroy();
+		return false;
+	}
+	current = Regions - 1;
+	return true;
+}
+
+void UploadRing::destroy() {
+	for (int r = 0; r < Regions; r++) {
+		if (fences[r]) glDeleteSync(fences[r]);
+		fences[r] = 0;
+	}
+	if (bufferID) {
+		if (mapped) {
+			glBindBuffer(GL_ARRAY_BUFFER, bufferID);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+		}
+		glDeleteBuffers(1, &bufferID);
+	}
+	bufferID = 0;
+	mapped = nullptr;
+	regionBytes = 0;
+}
+
+void* UploadRing::beginFrame() {
+	current = (current + 1) % Regions;
+	GLsync fence = fences[current];
+	if (fence) {
+		// only blocks when the GPU is still two frames behind
+		GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		while (result == GL_TIMEOUT_EXPIRED) {
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+		}
+		glDeleteSync(fence);
+		fences[current] = 0;
+	}
+	return mapped + (size_t)current * regionBytes;
+}
+
+void UploadRing::endFrame() {
+	fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,41 @@
+#ifndef UPLOADRING_HPP
+#define UPLOADRING_HPP
+
+#include <cstddef>
+
+#include <GL/glew.h>
+
+// One buffer object split into three equal regions and mapped once for
+// the lifetime of the buffer (ARB_buffer_storage). Each frame the CPU
+// writes the next region while the GPU may still be reading the other
+// two; a fence per region makes the CPU wait only if it laps the GPU.
+class UploadRing {
+public:
+	static const int Regions = 3;
+
+	~UploadRing() { destroy(); }
+
+	// false when the driver lacks persistent mapping, the ring is unusable then
+	static bool supported();
+	bool create(size_t newRegionSize);
+	void destroy();
+
+	GLuint buffer() const { return bufferID; }
+	size_t regionSize() const { return regionBytes; }
+	// byte offset of the region handed out by the last beginFrame
+	size_t regionOffset() const { return (size_t)current * regionBytes; }
+
+	// waits until the GPU is done with the next region and returns it
+	void* beginFrame();
+	// fences the region, call after the draws that read it were issued
+	void endFrame();
+
+private:
+	GLuint bufferID = 0;
+	char* mapped = nullptr;
+	size_t regionBytes = 0;
+	int current = Regions - 1;
+	GLsync fences[Regions] = {};
+};
+
+#endif